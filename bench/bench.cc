@@ -0,0 +1,261 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ *
+ * Runs the registered benchmarks and writes the results as JSON or CSV.
+ * Usage: bench [--filter=SUBSTRING] [--format=json|csv] [--output=FILE]
+ *              [--min-time=SECONDS]
+ */
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace bench {
+namespace {
+
+struct Benchmark {
+  std::string name;
+  Function function;
+};
+
+struct Result {
+  std::string name;
+  uint64_t iterations = 0;
+  uint64_t items = 0;
+  double seconds = 0.0;
+  bool skipped = false;
+  bool failed = false;
+  std::string note;
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+std::vector<Benchmark>& Benchmarks() {
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+// Runs the benchmark with increasing iteration counts until the measured
+// time reaches the minimum time.
+Result Run(const Benchmark& benchmark, double min_time) {
+  Result result;
+  result.name = benchmark.name;
+  uint64_t iterations = 1;
+  while (true) {
+    State state(iterations);
+    state.ResumeTiming();
+    benchmark.function(&state);
+    state.PauseTiming();
+
+    result.iterations = iterations;
+    result.items = iterations * state.ItemsPerIteration();
+    result.seconds = state.Seconds();
+    result.counters = state.Counters();
+    if (state.Skipped()) {
+      result.skipped = true;
+      result.note = state.SkipReason();
+      return result;
+    }
+    if (state.Failed()) {
+      result.failed = true;
+      result.note = state.FailReason();
+      return result;
+    }
+    if (state.Seconds() >= min_time || iterations >= (1ull << 40)) {
+      return result;
+    }
+
+    // Estimate the iterations for the minimum time, but grow at least by
+    // a factor of two and at most by a factor of ten per run.
+    const double estimate = state.Seconds() > 0.0
+        ? iterations * min_time * 1.2 / state.Seconds()
+        : iterations * 10.0;
+    iterations = static_cast<uint64_t>(std::min(
+        std::max(estimate, iterations * 2.0), iterations * 10.0));
+  }
+}
+
+std::string JsonString(const std::string& value) {
+  std::string result = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+    }
+    result += c;
+  }
+  return result + "\"";
+}
+
+void WriteJson(const std::vector<Result>& results, std::ostream& out) {
+  out << "{\n  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    const double items = static_cast<double>(result.items);
+    out << (i == 0 ? "\n" : ",\n") << "    {"
+        << "\"name\": " << JsonString(result.name)
+        << ", \"iterations\": " << result.iterations
+        << ", \"items\": " << result.items
+        << ", \"seconds\": " << result.seconds
+        << ", \"ns_per_item\": "
+        << (result.items > 0 ? result.seconds * 1e9 / items : 0.0)
+        << ", \"items_per_second\": "
+        << (result.seconds > 0.0 ? items / result.seconds : 0.0)
+        << ", \"skipped\": " << (result.skipped ? "true" : "false")
+        << ", \"failed\": " << (result.failed ? "true" : "false")
+        << ", \"note\": " << JsonString(result.note)
+        << ", \"counters\": {";
+    for (std::size_t j = 0; j < result.counters.size(); ++j) {
+      out << (j == 0 ? "" : ", ") << JsonString(result.counters[j].first)
+          << ": " << result.counters[j].second;
+    }
+    out << "}}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+void WriteCsv(const std::vector<Result>& results, std::ostream& out) {
+  out << "name,iterations,items,seconds,ns_per_item,items_per_second,"
+      << "skipped,failed,note,counters\n";
+  for (const Result& result : results) {
+    const double items = static_cast<double>(result.items);
+    out << result.name << "," << result.iterations << "," << result.items
+        << "," << result.seconds << ","
+        << (result.items > 0 ? result.seconds * 1e9 / items : 0.0) << ","
+        << (result.seconds > 0.0 ? items / result.seconds : 0.0) << ","
+        << (result.skipped ? 1 : 0) << "," << (result.failed ? 1 : 0) << ","
+        << result.note << ",";
+    for (std::size_t j = 0; j < result.counters.size(); ++j) {
+      out << (j == 0 ? "" : ";") << result.counters[j].first << "="
+          << result.counters[j].second;
+    }
+    out << "\n";
+  }
+}
+
+// Returns the value of a "--name=value" argument, or nullptr.
+const char* ArgumentValue(const char* arg, const char* name) {
+  const std::size_t length = std::strlen(name);
+  if (std::strncmp(arg, name, length) == 0 && arg[length] == '=') {
+    return arg + length + 1;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+State::State(uint64_t iterations)
+    : iterations_(iterations) {
+}
+
+void
+State::Skip(const std::string& reason) {
+  skipped_ = true;
+  skip_reason_ = reason;
+}
+
+void
+State::Fail(const std::string& reason) {
+  failed_ = true;
+  fail_reason_ = reason;
+}
+
+void
+State::SetCounter(const std::string& name, double value) {
+  for (auto& counter : counters_) {
+    if (counter.first == name) {
+      counter.second = value;
+      return;
+    }
+  }
+  counters_.push_back(std::make_pair(name, value));
+}
+
+void
+State::PauseTiming() {
+  if (running_) {
+    const std::chrono::duration<double> elapsed = Clock::now() - start_;
+    seconds_ += elapsed.count();
+    running_ = false;
+  }
+}
+
+void
+State::ResumeTiming() {
+  if (!running_) {
+    start_ = Clock::now();
+    running_ = true;
+  }
+}
+
+bool
+Register(const std::string& name, Function function) {
+  Benchmarks().push_back(Benchmark{name, function});
+  return true;
+}
+
+}  // namespace bench
+
+int main(int argc, char** argv) {
+  std::string filter;
+  std::string format = "json";
+  std::string output;
+  double min_time = 0.5;
+  for (int i = 1; i < argc; ++i) {
+    const char* value = nullptr;
+    if ((value = bench::ArgumentValue(argv[i], "--filter")) != nullptr) {
+      filter = value;
+    } else if ((value = bench::ArgumentValue(argv[i], "--format")) != nullptr) {
+      format = value;
+    } else if ((value = bench::ArgumentValue(argv[i], "--output")) != nullptr) {
+      output = value;
+    } else if ((value = bench::ArgumentValue(argv[i], "--min-time"))
+        != nullptr) {
+      min_time = std::atof(value);
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--filter=SUBSTRING]"
+          << " [--format=json|csv] [--output=FILE] [--min-time=SECONDS]"
+          << std::endl;
+      return 1;
+    }
+  }
+  if (format != "json" && format != "csv") {
+    std::cerr << "Unknown format: " << format << std::endl;
+    return 1;
+  }
+
+  // Progress goes to stderr, so that stdout only contains the results.
+  std::vector<bench::Result> results;
+  bool failed = false;
+  for (const bench::Benchmark& benchmark : bench::Benchmarks()) {
+    if (benchmark.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    std::cerr << "Running " << benchmark.name << "..." << std::endl;
+    results.push_back(bench::Run(benchmark, min_time));
+    if (results.back().failed) {
+      std::cerr << "Failed " << benchmark.name << ": "
+          << results.back().note << std::endl;
+      failed = true;
+    }
+  }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output.c_str());
+    if (!file.good()) {
+      std::cerr << "Error writing " << output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out = output.empty() ? std::cout : file;
+  if (format == "csv") {
+    bench::WriteCsv(results, out);
+  } else {
+    bench::WriteJson(results, out);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_BENCH_HEADER
+#define GAMEPAD_BENCH_HEADER
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+// Controls a single run of a benchmark. The benchmark performs its operation
+// Iterations() times. The runner measures the whole benchmark function,
+// use PauseTiming() and ResumeTiming() to exclude setup and teardown.
+class State {
+ public:
+  explicit State(uint64_t iterations);
+
+  uint64_t Iterations() const { return iterations_; }
+  // Sets the number of items (e.g., events) processed per iteration. The
+  // results are reported per item.
+  void SetItemsPerIteration(uint64_t items) { items_per_iteration_ = items; }
+  uint64_t ItemsPerIteration() const { return items_per_iteration_; }
+  // Marks the benchmark as skipped, e.g., if a device is not available.
+  void Skip(const std::string& reason);
+  bool Skipped() const { return skipped_; }
+  const std::string& SkipReason() const { return skip_reason_; }
+  // Marks the benchmark as failed, e.g., if it observed a wrong result.
+  // The runner then exits with an error.
+  void Fail(const std::string& reason);
+  bool Failed() const { return failed_; }
+  const std::string& FailReason() const { return fail_reason_; }
+  // Reports an additional value with the results, e.g., syscalls per event.
+  void SetCounter(const std::string& name, double value);
+  const std::vector<std::pair<std::string, double>>& Counters() const {
+    return counters_;
+  }
+
+  void PauseTiming();
+  void ResumeTiming();
+  double Seconds() const { return seconds_; }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  uint64_t iterations_;
+  uint64_t items_per_iteration_ = 1;
+  bool skipped_ = false;
+  std::string skip_reason_;
+  bool failed_ = false;
+  std::string fail_reason_;
+  std::vector<std::pair<std::string, double>> counters_;
+  bool running_ = false;
+  Clock::time_point start_;
+  double seconds_ = 0.0;
+};
+
+typedef std::function<void(State*)> Function;
+
+// Registers a benchmark. Returns true so that it can initialize a static.
+bool Register(const std::string& name, Function function);
+
+// Prevents the compiler from optimizing away the computation of a value.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}  // namespace bench
+
+// Registers a benchmark function with its name.
+#define BENCHMARK(function) \
+  static const bool function##_registered = \
+      bench::Register(#function, function)
+
+#endif  // GAMEPAD_BENCH_HEADER
@@ -0,0 +1,675 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ *
+ * Benchmarks of the Linux evdev backend: event lookup, reading input and
+ * the read() syscalls per event, attaching devices, scanning the device
+ * directory and rumble. Benchmarks that need a real evdev device create one with
+ * uinput, and are skipped if /dev/uinput is not accessible.
+ */
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "gamepad_linux.h"
+
+namespace gamepad {
+
+// Provides the benchmarks with access to the evdev internals.
+class SystemImplPeer {
+ public:
+  explicit SystemImplPeer(SystemImpl* system) : system_(system) {}
+
+  // Uses the directory instead of /dev/input/by-id/. The directory needs
+  // a trailing slash.
+  void SetDevicesDirectory(const std::string& directory) {
+    system_->devices_directory_ = directory;
+  }
+
+  // Adds a device with the typical layout of a gamepad, without a device
+  // file. Returns the device, which is attached.
+  EvdevDevice* AddGamepad() {
+    const DeviceHandle handle = system_->devices_.Insert();
+    EvdevDevice* device = system_->devices_.Get(handle);
+    device->device.handle = handle;
+    int button_id = 0;
+    for (unsigned int code = BTN_SOUTH; code <= BTN_THUMBR; ++code) {
+      device->layout.key_map.Add(code, button_id++);
+    }
+    device->device.buttons.resize(button_id, false);
+    for (unsigned int code : { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ,
+        ABS_HAT0X, ABS_HAT0Y }) {
+      EvdevAxisInfo axis_info;
+      axis_info.code = code;
+      axis_info.minimum = -32768;
+      axis_info.maximum = 32767;
+      axis_info.transform = MakeAxisTransform(-32768, 32767, 16, 128);
+      device->layout.axis_map.axis_id[code] =
+          static_cast<int8_t>(device->layout.axis_infos.size());
+      device->layout.axis_infos.push_back(axis_info);
+    }
+    device->device.axes.resize(device->layout.axis_infos.size(), 0.0f);
+    system_->HandleAttach(&device->device);
+    return device;
+  }
+
+  void ProcessEvent(EvdevDevice* device, unsigned int type,
+      unsigned int code, int value) {
+    system_->EvdevProcessEvent(device, type, code, value, 0.0);
+  }
+
+  // Registers the descriptor of the device with the epoll set.
+  void Watch(EvdevDevice* device) {
+    if (!system_->initialized_) {
+      system_->Initialize();
+    }
+    system_->EvdevWatchDevice(*device);
+  }
+
+  void ReadInputs() { system_->EvdevReadInputs(); }
+  void Initialize(const std::string& filename) {
+    system_->EvdevInitialize(filename);
+  }
+  void WatchDirectory() { system_->EvdevWatchDirectory(); }
+  void ClearLayoutCache() { system_->layout_cache_.Clear(); }
+
+  // Returns an attached device, or nullptr.
+  EvdevDevice* AnyDevice() {
+    auto iter = system_->devices_.begin();
+    return iter != system_->devices_.end() ? &*iter : nullptr;
+  }
+
+  // Detaches all devices.
+  void DetachAll() {
+    for (EvdevDevice& device : system_->devices_) {
+      system_->EvdevCleanup(&device);
+    }
+    system_->EvdevDetachRemoved();
+  }
+
+ private:
+  SystemImpl* system_;
+};
+
+namespace {
+
+// A gamepad created with uinput, used as a real evdev device. With rumble,
+// the gamepad supports FF_RUMBLE and acknowledges effect uploads on a
+// thread, since uinput forwards them to the creator of the device.
+class UinputGamepad {
+ public:
+  explicit UinputGamepad(bool rumble = false) {
+    struct libevdev* evdev = libevdev_new();
+    if (evdev == nullptr) {
+      return;
+    }
+    libevdev_set_name(evdev, "Gamepad benchmark device");
+    libevdev_enable_event_type(evdev, EV_KEY);
+    for (unsigned int code = BTN_SOUTH; code <= BTN_THUMBR; ++code) {
+      libevdev_enable_event_code(evdev, EV_KEY, code, nullptr);
+    }
+    struct input_absinfo abs;
+    std::memset(&abs, 0, sizeof(abs));
+    abs.minimum = -32768;
+    abs.maximum = 32767;
+    abs.fuzz = 16;
+    abs.flat = 128;
+    libevdev_enable_event_type(evdev, EV_ABS);
+    for (unsigned int code : { ABS_X, ABS_Y, ABS_RX, ABS_RY }) {
+      libevdev_enable_event_code(evdev, EV_ABS, code, &abs);
+    }
+    if (rumble) {
+      libevdev_enable_event_type(evdev, EV_FF);
+      libevdev_enable_event_code(evdev, EV_FF, FF_RUMBLE, nullptr);
+    }
+    const int rc = libevdev_uinput_create_from_device(evdev,
+        LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput_);
+    libevdev_free(evdev);
+    if (rc < 0) {
+      uinput_ = nullptr;
+      error_ = std::string("uinput not available: ") + std::strerror(-rc);
+    } else if (rumble) {
+      effect_thread_ = std::thread(&UinputGamepad::ServiceEffects, this);
+    }
+  }
+
+  ~UinputGamepad() {
+    if (effect_thread_.joinable()) {
+      stop_ = true;
+      effect_thread_.join();
+    }
+    if (uinput_ != nullptr) {
+      libevdev_uinput_destroy(uinput_);
+    }
+  }
+
+  // Returns the device node, or nullptr if the device was not created.
+  const char* DeviceNode() const {
+    return uinput_ != nullptr ? libevdev_uinput_get_devnode(uinput_)
+        : nullptr;
+  }
+  const std::string& Error() const { return error_; }
+  // Returns the number of effect uploads so far.
+  int NumUploads() const { return num_uploads_; }
+
+ private:
+  // Acknowledges the effect uploads and erasures of clients.
+  void ServiceEffects() {
+    const int file_descriptor = libevdev_uinput_get_fd(uinput_);
+    while (!stop_) {
+      struct pollfd poll_fd = { file_descriptor, POLLIN, 0 };
+      struct input_event event;
+      if (::poll(&poll_fd, 1, 10) <= 0 ||
+          ::read(file_descriptor, &event, sizeof(event)) != sizeof(event) ||
+          event.type != EV_UINPUT) {
+        continue;
+      }
+      if (event.code == UI_FF_UPLOAD) {
+        struct uinput_ff_upload upload;
+        std::memset(&upload, 0, sizeof(upload));
+        upload.request_id = event.value;
+        ::ioctl(file_descriptor, UI_BEGIN_FF_UPLOAD, &upload);
+        upload.retval = 0;
+        num_uploads_ += 1;
+        ::ioctl(file_descriptor, UI_END_FF_UPLOAD, &upload);
+      } else if (event.code == UI_FF_ERASE) {
+        struct uinput_ff_erase erase;
+        std::memset(&erase, 0, sizeof(erase));
+        erase.request_id = event.value;
+        ::ioctl(file_descriptor, UI_BEGIN_FF_ERASE, &erase);
+        erase.retval = 0;
+        ::ioctl(file_descriptor, UI_END_FF_ERASE, &erase);
+      }
+    }
+  }
+
+ private:
+  struct libevdev_uinput* uinput_ = nullptr;
+  std::string error_ = "uinput device has no device node";
+  std::thread effect_thread_;
+  std::atomic<bool> stop_{false};
+  std::atomic<int> num_uploads_{0};
+};
+
+// A raw input event of the benchmark input.
+struct RawEvent {
+  unsigned int type;
+  unsigned int code;
+  int value;
+};
+
+// Generates reports with a button toggle and two axis changes each.
+std::vector<RawEvent> MakeRawInput(int num_reports) {
+  std::vector<RawEvent> input;
+  for (int report = 0; report < num_reports; ++report) {
+    const unsigned int button = BTN_SOUTH + report % 4;
+    input.push_back({ EV_KEY, button,
+        static_cast<int>((report / 4) % 2 == 0) });
+    const int value = report % 2 == 0 ? 20000 : -20000;
+    input.push_back({ EV_ABS, ABS_X, value });
+    input.push_back({ EV_ABS, ABS_Y, -value });
+    input.push_back({ EV_SYN, SYN_REPORT, 0 });
+  }
+  return input;
+}
+
+void EvdevProcessEventLookup(bench::State* state) {
+  state->PauseTiming();
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  EvdevDevice* device = peer.AddGamepad();
+  const std::vector<RawEvent> input = MakeRawInput(1000);
+  state->SetItemsPerIteration(input.size());
+  state->ResumeTiming();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    for (const RawEvent& event : input) {
+      peer.ProcessEvent(device, event.type, event.code, event.value);
+    }
+  }
+}
+BENCHMARK(EvdevProcessEventLookup);
+
+// Button codes of a gamepad, as reported in random order.
+std::vector<unsigned int> MakeButtonCodes() {
+  std::vector<unsigned int> codes;
+  for (unsigned int i = 0; i < 1024; ++i) {
+    codes.push_back(BTN_SOUTH + (i * 7) % (BTN_THUMBR - BTN_SOUTH + 1));
+  }
+  return codes;
+}
+
+void EvdevKeyMapLookup(bench::State* state) {
+  EvdevKeyMap key_map;
+  for (unsigned int code = BTN_SOUTH; code <= BTN_THUMBR; ++code) {
+    key_map.Add(code, code - BTN_SOUTH);
+  }
+  const std::vector<unsigned int> codes = MakeButtonCodes();
+  state->SetItemsPerIteration(codes.size());
+  int sum = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    for (unsigned int code : codes) {
+      sum += key_map.Lookup(code);
+    }
+  }
+  bench::DoNotOptimize(sum);
+}
+BENCHMARK(EvdevKeyMapLookup);
+
+// The ordered map that was used for button lookup before EvdevKeyMap, for
+// comparison.
+void StdMapKeyLookup(bench::State* state) {
+  std::map<int, int> key_map;
+  for (unsigned int code = BTN_SOUTH; code <= BTN_THUMBR; ++code) {
+    key_map[code] = code - BTN_SOUTH;
+  }
+  const std::vector<unsigned int> codes = MakeButtonCodes();
+  state->SetItemsPerIteration(codes.size());
+  int sum = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    for (unsigned int code : codes) {
+      const auto iter = key_map.find(code);
+      sum += iter != key_map.end() ? iter->second : -1;
+    }
+  }
+  bench::DoNotOptimize(sum);
+}
+BENCHMARK(StdMapKeyLookup);
+
+// Returns the number of read() syscalls of the process so far, or -1 if
+// I/O accounting is not available.
+int64_t ReadSyscalls() {
+  std::ifstream file("/proc/self/io");
+  std::string key;
+  int64_t value = 0;
+  while (file >> key >> value) {
+    if (key == "syscr:") {
+      return value;
+    }
+  }
+  return -1;
+}
+
+// Converts the benchmark input to kernel events.
+std::vector<struct input_event> MakeKernelInput(int num_reports) {
+  std::vector<struct input_event> input;
+  for (const RawEvent& raw : MakeRawInput(num_reports)) {
+    struct input_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.type = raw.type;
+    event.code = raw.code;
+    event.value = raw.value;
+    input.push_back(event);
+  }
+  return input;
+}
+
+// Writes the input to the pipe and runs the read function for every
+// iteration. Reports the read() syscalls per event, excluding the syscalls
+// of reading the I/O accounting itself.
+void RunPipe(bench::State* state, int write_fd,
+    const std::function<void()>& read_function) {
+  // The input fits into the pipe buffer.
+  const std::vector<struct input_event> input = MakeKernelInput(500);
+  const std::size_t input_size = input.size() * sizeof(struct input_event);
+  state->SetItemsPerIteration(input.size());
+  const int64_t calibration = ReadSyscalls();
+  const int64_t overhead = ReadSyscalls() - calibration;
+  const int64_t start = ReadSyscalls();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    if (::write(write_fd, input.data(), input_size) !=
+        static_cast<ssize_t>(input_size)) {
+      state->Skip("Failed to write to the pipe");
+      return;
+    }
+    state->ResumeTiming();
+    read_function();
+    state->PauseTiming();
+  }
+  const int64_t end = ReadSyscalls();
+  if (start >= 0 && end >= 0) {
+    state->SetCounter("syscalls_per_event",
+        static_cast<double>(end - start - overhead) /
+        (state->Iterations() * input.size()));
+  }
+}
+
+// Reads input through the full read loop, which reads batches of events
+// with read(). The device reads from a pipe that carries the input.
+void EvdevReadInputsPipe(bench::State* state) {
+  state->PauseTiming();
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  EvdevDevice* device = peer.AddGamepad();
+  int fds[2];
+  if (::pipe2(fds, O_NONBLOCK) < 0) {
+    state->Skip("Failed to create a pipe");
+    return;
+  }
+  device->file_descriptor = fds[0];
+  RunPipe(state, fds[1], [&peer]() { peer.ReadInputs(); });
+  device->file_descriptor = -1;
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+BENCHMARK(EvdevReadInputsPipe);
+
+// The read loop with one libevdev_next_event() call per event that was used
+// before reading batches, for comparison. The libevdev device is created
+// from a uinput device, then its descriptor is replaced with the pipe.
+void LibevdevNextEventPipe(bench::State* state) {
+  state->PauseTiming();
+  UinputGamepad gamepad;
+  if (gamepad.DeviceNode() == nullptr) {
+    state->Skip(gamepad.Error());
+    return;
+  }
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  EvdevDevice* device = peer.AddGamepad();
+  const int uinput_fd = ::open(gamepad.DeviceNode(), O_RDONLY | O_NONBLOCK);
+  struct libevdev* evdev = nullptr;
+  if (uinput_fd < 0 || libevdev_new_from_fd(uinput_fd, &evdev) < 0) {
+    state->Skip("Failed to open the uinput device");
+    if (uinput_fd >= 0) {
+      ::close(uinput_fd);
+    }
+    return;
+  }
+  int fds[2];
+  if (::pipe2(fds, O_NONBLOCK) < 0) {
+    state->Skip("Failed to create a pipe");
+  } else {
+    libevdev_change_fd(evdev, fds[0]);
+    RunPipe(state, fds[1], [&peer, device, evdev]() {
+      struct input_event event;
+      while (libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &event) ==
+          LIBEVDEV_READ_STATUS_SUCCESS) {
+        peer.ProcessEvent(device, event.type, event.code, event.value);
+      }
+    });
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+  libevdev_free(evdev);
+  ::close(uinput_fd);
+}
+BENCHMARK(LibevdevNextEventPipe);
+
+// Pipes that stand in for the descriptors of many attached devices.
+class DevicePipes {
+ public:
+  DevicePipes(SystemImplPeer* peer, int num_devices) {
+    for (int i = 0; i < num_devices; ++i) {
+      int fds[2];
+      if (::pipe2(fds, O_NONBLOCK) < 0) {
+        break;
+      }
+      EvdevDevice* device = peer->AddGamepad();
+      device->file_descriptor = fds[0];
+      peer->Watch(device);
+      devices_.push_back(device);
+      write_fds_.push_back(fds[1]);
+    }
+  }
+
+  ~DevicePipes() {
+    for (std::size_t i = 0; i < devices_.size(); ++i) {
+      ::close(devices_[i]->file_descriptor);
+      devices_[i]->file_descriptor = -1;
+      ::close(write_fds_[i]);
+    }
+  }
+
+  std::size_t Size() const { return devices_.size(); }
+  int WriteDescriptor(std::size_t index) const { return write_fds_[index]; }
+
+ private:
+  std::vector<EvdevDevice*> devices_;
+  std::vector<int> write_fds_;
+};
+
+// Processes a frame of input, where only one of many attached devices has
+// a pending report. Reports the read() syscalls per frame.
+void RunIdleDevices(bench::State* state, int num_devices,
+    const std::function<void(SystemImpl*, SystemImplPeer*)>& process) {
+  state->PauseTiming();
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  DevicePipes pipes(&peer, num_devices);
+  if (pipes.Size() != static_cast<std::size_t>(num_devices)) {
+    state->Skip("Failed to create the pipes");
+    return;
+  }
+  const std::vector<struct input_event> report = MakeKernelInput(1);
+  const std::size_t report_size = report.size() * sizeof(struct input_event);
+  const int64_t calibration = ReadSyscalls();
+  const int64_t overhead = ReadSyscalls() - calibration;
+  const int64_t start = ReadSyscalls();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    const int write_fd = pipes.WriteDescriptor(i % pipes.Size());
+    if (::write(write_fd, report.data(), report_size) !=
+        static_cast<ssize_t>(report_size)) {
+      state->Skip("Failed to write to the pipe");
+      return;
+    }
+    state->ResumeTiming();
+    process(&system, &peer);
+    state->PauseTiming();
+  }
+  const int64_t end = ReadSyscalls();
+  if (start >= 0 && end >= 0) {
+    state->SetCounter("syscalls_per_frame",
+        static_cast<double>(end - start - overhead) / state->Iterations());
+  }
+}
+
+// Reads every attached device, which was done before reads were driven by
+// the epoll ready list, for comparison.
+void ReadAllDevices64(bench::State* state) {
+  RunIdleDevices(state, 64, [](SystemImpl*, SystemImplPeer* peer) {
+    peer->ReadInputs();
+  });
+}
+BENCHMARK(ReadAllDevices64);
+
+void ProcessEventsIdleDevices64(bench::State* state) {
+  RunIdleDevices(state, 64, [](SystemImpl* system, SystemImplPeer*) {
+    system->ProcessEvents();
+  });
+}
+BENCHMARK(ProcessEventsIdleDevices64);
+
+// Attaches and detaches a uinput device. Without the layout cache, every
+// attach probes the device like a first attach.
+void RunAttach(bench::State* state, bool use_cache) {
+  state->PauseTiming();
+  UinputGamepad gamepad;
+  if (gamepad.DeviceNode() == nullptr) {
+    state->Skip(gamepad.Error());
+    return;
+  }
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    if (!use_cache) {
+      peer.ClearLayoutCache();
+    }
+    state->ResumeTiming();
+    peer.Initialize(gamepad.DeviceNode());
+    state->PauseTiming();
+    peer.DetachAll();
+  }
+}
+
+void EvdevAttach(bench::State* state) { RunAttach(state, false); }
+BENCHMARK(EvdevAttach);
+void EvdevReattach(bench::State* state) { RunAttach(state, true); }
+BENCHMARK(EvdevReattach);
+
+// Rumbles a uinput gamepad every iteration, like a game that pulses rumble
+// every frame. Reports the effect uploads per call: the same rumble is
+// uploaded once and then only played again, changed magnitudes update the
+// uploaded effect.
+void RunRumble(bench::State* state, bool change_magnitude) {
+  state->PauseTiming();
+  UinputGamepad gamepad(true);
+  if (gamepad.DeviceNode() == nullptr) {
+    state->Skip(gamepad.Error());
+    return;
+  }
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  peer.Initialize(gamepad.DeviceNode());
+  EvdevDevice* device = peer.AnyDevice();
+  if (device == nullptr ||
+      !system.Rumble(&device->device, 0.5f, 0.5f, 0.1)) {
+    state->Skip("Failed to rumble the uinput device");
+    return;
+  }
+  const int start = gamepad.NumUploads();
+  state->ResumeTiming();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    const float strong = change_magnitude && i % 2 == 0 ? 0.25f : 0.5f;
+    system.Rumble(&device->device, strong, 0.5f, 0.1);
+  }
+  state->PauseTiming();
+  state->SetCounter("uploads_per_call",
+      static_cast<double>(gamepad.NumUploads() - start) /
+      state->Iterations());
+}
+
+void RumbleRepeated(bench::State* state) { RunRumble(state, false); }
+BENCHMARK(RumbleRepeated);
+void RumbleChanging(bench::State* state) { RunRumble(state, true); }
+BENCHMARK(RumbleChanging);
+
+// Looks up the layout of a gamepad among several cached layouts, which is
+// the validation step of a re-attach.
+void EvdevLayoutCacheFind(bench::State* state) {
+  constexpr std::size_t kBitsPerLong = sizeof(unsigned long) * 8;
+  std::vector<unsigned long> key_bits(KEY_MAX / kBitsPerLong + 1, 0);
+  std::vector<unsigned long> abs_bits(ABS_MAX / kBitsPerLong + 1, 0);
+  for (unsigned int code = BTN_SOUTH; code <= BTN_THUMBR; ++code) {
+    key_bits[code / kBitsPerLong] |= 1ul << (code % kBitsPerLong);
+  }
+  for (unsigned int code : { ABS_X, ABS_Y, ABS_RX, ABS_RY }) {
+    abs_bits[code / kBitsPerLong] |= 1ul << (code % kBitsPerLong);
+  }
+  EvdevLayoutCache cache;
+  struct input_id id;
+  std::memset(&id, 0, sizeof(id));
+  id.bustype = BUS_BLUETOOTH;
+  id.vendor = 0x054c;
+  for (int i = 0; i < 8; ++i) {
+    id.product = static_cast<uint16_t>(0x0ce0 + i);
+    cache.Insert(id, key_bits.data(), abs_bits.data(), EvdevLayout());
+  }
+  const EvdevLayout* layout = nullptr;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    bench::DoNotOptimize(id);
+    layout = cache.Find(id, key_bits.data(), abs_bits.data());
+    bench::DoNotOptimize(layout);
+  }
+}
+BENCHMARK(EvdevLayoutCacheFind);
+
+// A temporary directory with entries that look like the by-id directory of
+// a system with many input devices, none of which are joysticks.
+class FakeDevicesDirectory {
+ public:
+  explicit FakeDevicesDirectory(int num_entries) {
+    char path[] = "/tmp/gamepad-bench-XXXXXX";
+    if (::mkdtemp(path) == nullptr) {
+      return;
+    }
+    path_ = std::string(path) + "/";
+    for (int i = 0; i < num_entries; ++i) {
+      const std::string name = "usb-Vendor_Device_" + std::to_string(i) +
+          (i % 2 == 0 ? "-event-kbd" : "-event-mouse");
+      const int fd = ::open((path_ + name).c_str(), O_CREAT | O_WRONLY, 0644);
+      if (fd >= 0) {
+        ::close(fd);
+        names_.push_back(name);
+      }
+    }
+  }
+
+  ~FakeDevicesDirectory() {
+    for (const std::string& name : names_) {
+      ::unlink((path_ + name).c_str());
+    }
+    if (!path_.empty()) {
+      ::rmdir(path_.c_str());
+    }
+  }
+
+  const std::string& Path() const { return path_; }
+
+ private:
+  std::string path_;
+  std::vector<std::string> names_;
+};
+
+// Scans a directory with the given number of entries.
+void ScanDirectory(bench::State* state, int num_entries) {
+  state->PauseTiming();
+  FakeDevicesDirectory directory(num_entries);
+  if (directory.Path().empty()) {
+    state->Skip("Failed to create the directory");
+    return;
+  }
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  peer.SetDevicesDirectory(directory.Path());
+  state->SetItemsPerIteration(num_entries);
+  state->ResumeTiming();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    peer.WatchDirectory();
+  }
+}
+
+void ScanDirectory16(bench::State* state) { ScanDirectory(state, 16); }
+BENCHMARK(ScanDirectory16);
+void ScanDirectory256(bench::State* state) { ScanDirectory(state, 256); }
+BENCHMARK(ScanDirectory256);
+void ScanDirectory4096(bench::State* state) { ScanDirectory(state, 4096); }
+BENCHMARK(ScanDirectory4096);
+
+// ScanForDevices() after the initial scan, when nothing has changed.
+void ScanForDevicesIdle(bench::State* state) {
+  state->PauseTiming();
+  FakeDevicesDirectory directory(256);
+  SystemImpl system;
+  SystemImplPeer peer(&system);
+  peer.SetDevicesDirectory(directory.Path());
+  system.ScanForDevices();
+  state->ResumeTiming();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    system.ScanForDevices();
+  }
+}
+BENCHMARK(ScanForDevicesIdle);
+
+}  // namespace
+}  // namespace gamepad
+
+#endif  // __linux__
@@ -0,0 +1,83 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ *
+ * Benchmarks of the mapping database: parsing a database of the size of
+ * SDL's gamecontrollerdb.txt, and looking up mappings at attach time.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "gamepad_mapping.h"
+
+namespace gamepad {
+namespace {
+
+constexpr int kNumModels = 600;
+const char* const kPlatforms[] = { "Windows", "Mac OS X", "Linux", "Android" };
+
+// Generates a database with a mapping per model and platform, with lines
+// like the ones of gamecontrollerdb.txt.
+std::string MakeDatabase() {
+  std::string database = "# Game controller mappings.\n";
+  char line[512];
+  for (const char* platform : kPlatforms) {
+    database += "\n# ";
+    database += platform;
+    database += "\n";
+    for (int model = 0; model < kNumModels; ++model) {
+      const int vendor = 0x0400 + model % 97;
+      const int product = 0x1000 + model;
+      std::snprintf(line, sizeof(line), "03000000%02x%02x0000%02x%02x0000"
+          "%02x%02x0000,Controller %d,a:b0,b:b1,back:b6,dpdown:h0.4,"
+          "dpleft:h0.8,dpright:h0.2,dpup:h0.1,guide:b8,leftshoulder:b4,"
+          "leftstick:b9,lefttrigger:a2,leftx:a0,lefty:a1,rightshoulder:b5,"
+          "rightstick:b10,righttrigger:a5,rightx:a3,righty:a4,start:b7,"
+          "x:b2,y:b3,platform:%s,\n",
+          vendor & 0xff, vendor >> 8, product & 0xff, product >> 8,
+          model % 4, 0x01, model, platform);
+      database += line;
+    }
+  }
+  return database;
+}
+
+void ParseMappingDatabase(bench::State* state) {
+  state->PauseTiming();
+  const std::string database = MakeDatabase();
+  state->ResumeTiming();
+  int num_mappings = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    MappingDatabase mappings;
+    num_mappings = mappings.Parse(database.data(), database.size(), "Linux");
+    bench::DoNotOptimize(mappings);
+  }
+  state->SetItemsPerIteration(1);
+  state->SetCounter("lines", kNumModels * 4);
+  state->SetCounter("mappings", num_mappings);
+  state->SetCounter("bytes", database.size());
+}
+BENCHMARK(ParseMappingDatabase);
+
+void FindMapping(bench::State* state) {
+  state->PauseTiming();
+  const std::string database = MakeDatabase();
+  MappingDatabase mappings;
+  mappings.Parse(database.data(), database.size(), "Linux");
+  state->ResumeTiming();
+  int found = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    // Alternate between exact matches, version fallbacks and misses.
+    const int model = i % kNumModels;
+    const uint16_t version = static_cast<uint16_t>(0x100 + i % 3);
+    found += mappings.Find(3, 0x0400 + model % 97, 0x1000 + model,
+        version) != nullptr;
+  }
+  bench::DoNotOptimize(found);
+}
+BENCHMARK(FindMapping);
+
+}  // namespace
+}  // namespace gamepad
@@ -0,0 +1,435 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ *
+ * Benchmarks of the platform-independent event processing: handler dispatch
+ * and axis normalization.
+ */
+#include <algorithm>
+#include <vector>
+
+#include "bench.h"
+#include "gamepad.h"
+
+namespace gamepad {
+namespace {
+
+constexpr int kNumButtons = 16;
+constexpr int kNumAxes = 8;
+constexpr int kNumReports = 1000;
+constexpr int kAxisMinimum = -32768;
+constexpr int kAxisMaximum = 32767;
+constexpr int kAxisFuzz = 16;
+constexpr int kAxisFlat = 128;
+
+// A decoded input event of the benchmark input.
+struct BenchEvent {
+  enum Type { kButton, kAxis, kReport };
+  Type type;
+  int id;
+  int value;
+};
+
+// Generates reports with the given number of button toggles and axis
+// changes. All events change the device state.
+std::vector<BenchEvent> MakeInput(int buttons_per_report,
+    int axes_per_report) {
+  std::vector<BenchEvent> input;
+  std::vector<bool> buttons(kNumButtons, false);
+  int axis_value = 0;
+  for (int report = 0; report < kNumReports; ++report) {
+    for (int i = 0; i < buttons_per_report; ++i) {
+      const int button_id = (report + i) % kNumButtons;
+      buttons[button_id] = !buttons[button_id];
+      input.push_back({ BenchEvent::kButton, button_id,
+          buttons[button_id] ? 1 : 0 });
+    }
+    for (int i = 0; i < axes_per_report; ++i) {
+      axis_value = axis_value > 0 ? -20000 + report : 20000 - report;
+      input.push_back({ BenchEvent::kAxis, (report + i) % kNumAxes,
+          axis_value });
+    }
+    input.push_back({ BenchEvent::kReport, 0, 0 });
+  }
+  return input;
+}
+
+// Returns the number of button and axis events of the input.
+uint64_t NumEvents(const std::vector<BenchEvent>& input) {
+  return std::count_if(input.begin(), input.end(),
+      [](const BenchEvent& event) {
+        return event.type != BenchEvent::kReport;
+      });
+}
+
+// A system with a single device that replays a prepared input through the
+// regular event processing on every ProcessEvents() call.
+class BenchSystem : public System {
+ public:
+  explicit BenchSystem(const std::vector<BenchEvent>& input)
+      : input_(input) {
+    transform_ = MakeAxisTransform(kAxisMinimum, kAxisMaximum, kAxisFuzz,
+        kAxisFlat);
+    device_.buttons.resize(kNumButtons, false);
+    device_.axes.resize(kNumAxes, 0.0f);
+    HandleAttach(&device_);
+  }
+
+  using System::ProcessEvents;
+  void ProcessEvents() override {
+    BeginProcessing();
+    double timestamp = 0.0;
+    for (const BenchEvent& event : input_) {
+      switch (event.type) {
+        case BenchEvent::kButton:
+          HandleButtonEvent(&device_, event.id, event.value, timestamp);
+          break;
+        case BenchEvent::kAxis:
+          HandleAxisEvent(&device_, event.id, event.value, transform_,
+              timestamp);
+          break;
+        case BenchEvent::kReport:
+          HandleReport(&device_);
+          timestamp += 0.004;
+          break;
+      }
+    }
+    EndProcessing();
+  }
+
+  void WaitForEvents(int) override { ProcessEvents(); }
+  void ScanForDevices() override {}
+  Device* GetDevice(DeviceHandle) override { return &device_; }
+
+ private:
+  std::vector<BenchEvent> input_;
+  AxisTransform transform_;
+  Device device_;
+};
+
+// Counts the events, which also keeps the handlers from being optimized out.
+struct Counter {
+  uint64_t count = 0;
+
+  void OnButtonDown(Device*, int button_id, double) { count += button_id; }
+  void OnButtonUp(Device*, int button_id, double) { count += button_id; }
+  void OnAxisMove(Device*, int axis_id, float, float, double) {
+    count += axis_id;
+  }
+};
+
+// Runs the input with handlers registered by the setup function.
+void RunHandlers(bench::State* state, const std::vector<BenchEvent>& input,
+    const std::function<void(BenchSystem*, Counter*)>& setup) {
+  state->PauseTiming();
+  BenchSystem system(input);
+  Counter counter;
+  setup(&system, &counter);
+  state->SetItemsPerIteration(NumEvents(input));
+  state->ResumeTiming();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    system.ProcessEvents();
+  }
+  bench::DoNotOptimize(counter.count);
+}
+
+// Registers button and axis handlers through RegisterButtonDownHandler()
+// and friends, which is the single std::function path.
+void RegisterHandlers(BenchSystem* system, Counter* counter) {
+  system->RegisterButtonDownHandler([counter](Device*, int id, double) {
+    counter->count += id;
+  });
+  system->RegisterButtonUpHandler([counter](Device*, int id, double) {
+    counter->count += id;
+  });
+  system->RegisterAxisMoveHandler(
+      [counter](Device*, int id, float, float, double) {
+        counter->count += id;
+      });
+}
+
+void ButtonEvents(bench::State* state) {
+  RunHandlers(state, MakeInput(2, 0), RegisterHandlers);
+}
+BENCHMARK(ButtonEvents);
+
+void AxisEvents(bench::State* state) {
+  RunHandlers(state, MakeInput(0, 2), RegisterHandlers);
+}
+BENCHMARK(AxisEvents);
+
+// Same as AxisEvents, with a radial dead zone on the stick of the first two
+// axes and the 1€ filter with a response curve on the others.
+void AxisEventsFiltered(bench::State* state) {
+  RunHandlers(state, MakeInput(0, 2), [](BenchSystem* system,
+      Counter* counter) {
+    RegisterHandlers(system, counter);
+    Device* device = system->GetDevice(DeviceHandle());
+    system->SetStickDeadZone(device, 0, 1, 0.1f, 0.95f);
+    AxisFilter filter;
+    filter.curve = 1.5f;
+    filter.min_cutoff = 1.0f;
+    filter.beta = 0.5f;
+    for (int axis_id = 2; axis_id < kNumAxes; ++axis_id) {
+      system->SetAxisFilter(device, axis_id, filter);
+    }
+  });
+}
+BENCHMARK(AxisEventsFiltered);
+
+void DispatchStdFunction(bench::State* state) {
+  RunHandlers(state, MakeInput(1, 2), RegisterHandlers);
+}
+BENCHMARK(DispatchStdFunction);
+
+// Same as DispatchStdFunction, with metrics collection enabled.
+void DispatchMetrics(bench::State* state) {
+  RunHandlers(state, MakeInput(1, 2), [](BenchSystem* system,
+      Counter* counter) {
+    RegisterHandlers(system, counter);
+    system->EnableMetrics(true);
+  });
+}
+BENCHMARK(DispatchMetrics);
+
+constexpr char kSharedMemoryName[] = "/gamepad_bench";
+
+// Same as DispatchStdFunction, with the device state additionally published
+// to shared memory after every report.
+void DispatchPublishing(bench::State* state) {
+  SharedSnapshotTable probe;
+  if (!probe.Create(kSharedMemoryName)) {
+    state->Skip("shared memory not available");
+    return;
+  }
+  probe.Close();
+  RunHandlers(state, MakeInput(1, 2), [](BenchSystem* system,
+      Counter* counter) {
+    RegisterHandlers(system, counter);
+    system->StartPublishing(kSharedMemoryName);
+  });
+}
+BENCHMARK(DispatchPublishing);
+
+// Reads a published device state through a StateReader, as another process
+// would.
+void ReadSharedSnapshot(bench::State* state) {
+  state->PauseTiming();
+  BenchSystem system(MakeInput(1, 2));
+  StateReader reader;
+  if (!system.StartPublishing(kSharedMemoryName) ||
+      !reader.Open(kSharedMemoryName)) {
+    state->Skip("shared memory not available");
+    return;
+  }
+  system.ProcessEvents();
+  state->ResumeTiming();
+  Snapshot snapshot;
+  uint64_t sequence = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    reader.GetSnapshot(0, &snapshot);
+    sequence += snapshot.sequence;
+  }
+  bench::DoNotOptimize(sequence);
+}
+BENCHMARK(ReadSharedSnapshot);
+
+// Same as DispatchStdFunction with coalescing. The axis handler is called
+// at most once per axis and pass, instead of once per change. The input
+// ends with the axis values it starts with, so after the first pass there
+// are no axis calls at all.
+void DispatchCoalesced(bench::State* state) {
+  uint64_t axis_calls = 0;
+  RunHandlers(state, MakeInput(1, 2), [&axis_calls](BenchSystem* system,
+      Counter* counter) {
+    RegisterHandlers(system, counter);
+    system->AddAxisMoveHandler([&axis_calls](Device*, int, float, float,
+        double) {
+      axis_calls += 1;
+    });
+    system->EnableCoalescing(true);
+  });
+  state->SetCounter("axis_calls_per_pass",
+      static_cast<double>(axis_calls) / state->Iterations());
+}
+BENCHMARK(DispatchCoalesced);
+
+void DispatchMultiSubscriber(bench::State* state) {
+  // Four subscribers per event type.
+  RunHandlers(state, MakeInput(1, 2), [](BenchSystem* system,
+      Counter* counter) {
+    for (int i = 0; i < 4; ++i) {
+      system->AddButtonDownHandler([counter](Device*, int id, double) {
+        counter->count += id;
+      });
+      system->AddButtonUpHandler([counter](Device*, int id, double) {
+        counter->count += id;
+      });
+      system->AddAxisMoveHandler(
+          [counter](Device*, int id, float, float, double) {
+            counter->count += id;
+          });
+    }
+  });
+}
+BENCHMARK(DispatchMultiSubscriber);
+
+void DispatchFrame(bench::State* state) {
+  RunHandlers(state, MakeInput(1, 2), [](BenchSystem* system,
+      Counter* counter) {
+    system->RegisterFrameHandler([counter](const Frame& frame) {
+      counter->count += frame.changed_axes.size() +
+          frame.pressed_buttons.size() + frame.released_buttons.size();
+    });
+  });
+}
+BENCHMARK(DispatchFrame);
+
+// Runs the input with the counter as visitor instead of handlers.
+void RunVisitor(bench::State* state, const std::vector<BenchEvent>& input) {
+  state->PauseTiming();
+  BenchSystem system(input);
+  Counter counter;
+  state->SetItemsPerIteration(NumEvents(input));
+  state->ResumeTiming();
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    system.ProcessEvents(counter);
+  }
+  bench::DoNotOptimize(counter.count);
+}
+
+// Same input as DispatchStdFunction.
+void DispatchVisitor(bench::State* state) {
+  RunVisitor(state, MakeInput(1, 2));
+}
+BENCHMARK(DispatchVisitor);
+
+// Same input as ButtonEvents, where dispatch is a larger part of the cost.
+void DispatchVisitorButtons(bench::State* state) {
+  RunVisitor(state, MakeInput(2, 0));
+}
+BENCHMARK(DispatchVisitorButtons);
+
+// Button states with every third button down, and a chord of four buttons.
+struct ChordInput {
+  std::vector<bool> buttons;
+  ButtonBits button_bits;
+  std::vector<int> chord;
+  ButtonBits chord_bits;
+
+  ChordInput() : buttons(kNumButtons, false) {
+    for (int i = 0; i < kNumButtons; i += 3) {
+      buttons[i] = true;
+      button_bits.Set(i);
+    }
+    for (int button_id : { 0, 3, 6, 9 }) {
+      chord.push_back(button_id);
+      chord_bits.Set(button_id);
+    }
+  }
+};
+
+// Checks a chord and whether any button is down with the vector<bool>.
+void ButtonQueriesVectorBool(bench::State* state) {
+  ChordInput input;
+  state->SetItemsPerIteration(2);
+  int count = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    bench::DoNotOptimize(input.buttons);
+    bool chord = true;
+    for (int button_id : input.chord) {
+      chord = chord && input.buttons[button_id];
+    }
+    const bool any = std::find(input.buttons.begin(), input.buttons.end(),
+        true) != input.buttons.end();
+    count += chord + any;
+  }
+  bench::DoNotOptimize(count);
+}
+BENCHMARK(ButtonQueriesVectorBool);
+
+void ButtonQueriesBits(bench::State* state) {
+  ChordInput input;
+  state->SetItemsPerIteration(2);
+  int count = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    bench::DoNotOptimize(input.button_bits);
+    count += input.button_bits.All(input.chord_bits) +
+        input.button_bits.Any();
+  }
+  bench::DoNotOptimize(count);
+}
+BENCHMARK(ButtonQueriesBits);
+
+// Raw axis values, flat values, and the transforms of the axes.
+struct AxisBatch {
+  std::vector<int> values;
+  std::vector<int> flats;
+  std::vector<float> scales;
+  std::vector<float> offsets;
+  std::vector<float> results;
+
+  explicit AxisBatch(std::size_t count) {
+    const AxisTransform transform = MakeAxisTransform(kAxisMinimum,
+        kAxisMaximum, kAxisFuzz, kAxisFlat);
+    for (std::size_t i = 0; i < count; ++i) {
+      values.push_back(kAxisMinimum + static_cast<int>(i * 7919 % 65536));
+      flats.push_back(transform.flat);
+      scales.push_back(transform.scale);
+      offsets.push_back(transform.offset);
+    }
+    results.resize(count);
+  }
+};
+
+constexpr std::size_t kAxisBatchSize = 8;
+
+// The normalization that was computed for every axis event before the
+// transforms were precomputed, for comparison.
+void NormalizeAxesPerEvent(bench::State* state) {
+  AxisBatch batch(kAxisBatchSize);
+  state->SetItemsPerIteration(kAxisBatchSize);
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    bench::DoNotOptimize(batch.values.data());
+    for (std::size_t j = 0; j < kAxisBatchSize; ++j) {
+      int value = batch.values[j];
+      value = value > -kAxisFlat && value < kAxisFlat ? 0 : value;
+      const float minimum = static_cast<float>(kAxisMinimum);
+      const float maximum = static_cast<float>(kAxisMaximum);
+      const float range = maximum - minimum;
+      const float norm = (static_cast<float>(value) - minimum) / range;
+      batch.results[j] = std::max(-1.0f, std::min(1.0f, 2.0f * norm - 1.0f));
+    }
+    bench::DoNotOptimize(batch.results.data());
+  }
+}
+BENCHMARK(NormalizeAxesPerEvent);
+
+void NormalizeAxesScalarBatch(bench::State* state) {
+  AxisBatch batch(kAxisBatchSize);
+  state->SetItemsPerIteration(kAxisBatchSize);
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    bench::DoNotOptimize(batch.values.data());
+    NormalizeAxesScalar(batch.values.data(), batch.scales.data(),
+        batch.offsets.data(), batch.flats.data(), batch.results.data(),
+        kAxisBatchSize);
+    bench::DoNotOptimize(batch.results.data());
+  }
+}
+BENCHMARK(NormalizeAxesScalarBatch);
+
+void NormalizeAxesBatch(bench::State* state) {
+  AxisBatch batch(kAxisBatchSize);
+  state->SetItemsPerIteration(kAxisBatchSize);
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    bench::DoNotOptimize(batch.values.data());
+    NormalizeAxes(batch.values.data(), batch.scales.data(),
+        batch.offsets.data(), batch.flats.data(), batch.results.data(),
+        kAxisBatchSize);
+    bench::DoNotOptimize(batch.results.data());
+  }
+}
+BENCHMARK(NormalizeAxesBatch);
+
+}  // namespace
+}  // namespace gamepad
@@ -0,0 +1,112 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ *
+ * Benchmarks of the SPSC ring buffer on its own, independent of a backend.
+ * Both benchmarks verify that items arrive complete and in order, and fail
+ * otherwise.
+ */
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "bench.h"
+#include "gamepad_ring_buffer.h"
+
+namespace gamepad {
+namespace {
+
+// Not a power of two, the buffer rounds up to 64.
+constexpr std::size_t kSmallCapacity = 50;
+constexpr std::size_t kThreadCapacity = 1024;
+constexpr uint64_t kItemsPerIteration = 1000;
+
+// Fills the buffer until it is full and drains it until it is empty, on a
+// single thread. The positions keep growing, so the indices wrap around the
+// buffer on every iteration.
+void RingBufferFillDrain(bench::State* state) {
+  SpscRingBuffer<uint64_t> buffer(kSmallCapacity);
+  const std::size_t capacity = buffer.Capacity();
+  if (capacity != 64) {
+    state->Fail("capacity not rounded up to a power of two");
+    return;
+  }
+  uint64_t next_push = 0;
+  uint64_t next_pop = 0;
+  uint64_t value = 0;
+  for (uint64_t i = 0; i < state->Iterations(); ++i) {
+    while (buffer.Push(next_push)) {
+      next_push += 1;
+    }
+    if (buffer.Size() != capacity || buffer.Available() != 0) {
+      state->Fail("full buffer does not hold its capacity");
+      return;
+    }
+    while (buffer.Pop(&value)) {
+      if (value != next_pop) {
+        state->Fail("item popped out of order");
+        return;
+      }
+      next_pop += 1;
+    }
+    if (buffer.Size() != 0 || buffer.Available() != capacity ||
+        next_pop != next_push) {
+      state->Fail("empty buffer does not match the pushed items");
+      return;
+    }
+  }
+  state->SetItemsPerIteration(capacity);
+}
+BENCHMARK(RingBufferFillDrain);
+
+// Passes sequence numbers from a producer thread to the consumer on the
+// calling thread. Both yield if the buffer is full or empty, which keeps
+// them going on a single core. Reports the fraction of pushes that found
+// the buffer full.
+void RingBufferProducerConsumer(bench::State* state) {
+  SpscRingBuffer<uint64_t> buffer(kThreadCapacity);
+  const uint64_t num_items = state->Iterations() * kItemsPerIteration;
+  std::atomic<uint64_t> full_pushes(0);
+  std::thread producer([&buffer, &full_pushes, num_items]() {
+    uint64_t num_full = 0;
+    for (uint64_t item = 0; item < num_items; ++item) {
+      while (!buffer.Push(item)) {
+        num_full += 1;
+        std::this_thread::yield();
+      }
+    }
+    full_pushes.store(num_full, std::memory_order_relaxed);
+  });
+
+  std::string error;
+  uint64_t num_popped = 0;
+  uint64_t value = 0;
+  while (num_popped < num_items) {
+    if (!buffer.Pop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (value != num_popped && error.empty()) {
+      error = "item " + std::to_string(value) + " popped at position " +
+          std::to_string(num_popped);
+    }
+    num_popped += 1;
+  }
+  producer.join();
+
+  if (buffer.Pop(&value)) {
+    error = "more items popped than pushed";
+  }
+  if (!error.empty()) {
+    state->Fail(error);
+    return;
+  }
+  state->SetItemsPerIteration(kItemsPerIteration);
+  state->SetCounter("full_per_push",
+      static_cast<double>(full_pushes.load()) / num_items);
+}
+BENCHMARK(RingBufferProducerConsumer);
+
+}  // namespace
+}  // namespace gamepad
@@ -4,77 +4,770 @@
  */
 #include "gamepad.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <map>
 
-#include "gamepad_libstem.h"
 #include "gamepad_linux.h"
 #include "gamepad_osx.h"
+#include "gamepad_synthetic.h"
 
 namespace gamepad {
 
+constexpr int System::kMaxSnapshotDevices;
+
+namespace {
+
+// The interval in milliseconds in which WaitForEvents() advances settling
+// filters while no input arrives.
+constexpr int kSettleIntervalMs = 4;
+
+// Returns the named backends, initialized with the built-in backends.
+std::map<std::string, System::BackendFactory>& Backends() {
+  static std::map<std::string, System::BackendFactory> backends = {
+    { "native", []() { return System::Create(); } },
+    { "synthetic", []() {
+      return std::unique_ptr<System>(new SyntheticSystem(SyntheticConfig()));
+    } },
+  };
+  return backends;
+}
+
+// Returns the time of the steady clock in seconds.
+double SteadyTime() {
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now().time_since_epoch();
+  return time.count();
+}
+
+// Removes a handler from the list if the list contains it.
+template <typename Handler>
+void RemoveFromList(HandlerList<Handler>* list, int handler_id) {
+  for (auto iter = list->added.begin(); iter != list->added.end(); ++iter) {
+    if (iter->first == handler_id) {
+      list->added.erase(iter);
+      return;
+    }
+  }
+}
+
+}  // namespace
+
 std::unique_ptr<System>
 System::Create() {
   return std::unique_ptr<System>(new SystemImpl());
 }
 
+std::unique_ptr<System>
+System::Create(const std::string& backend) {
+  const auto iter = Backends().find(backend);
+  if (iter == Backends().end()) {
+    return nullptr;
+  }
+  return iter->second();
+}
+
+void
+System::RegisterBackend(const std::string& name, BackendFactory factory) {
+  Backends()[name] = factory;
+}
+
 void
 System::RegisterAttachHandler(AttachedHandler handler) {
-  attached_handler_ = handler;
+  attached_handler_.primary = handler;
 }
 
 void
 System::RegisterDetachHandler(DetachedHandler handler) {
-  detached_handler_ = handler;
+  detached_handler_.primary = handler;
 }
 
 void
 System::RegisterButtonDownHandler(ButtonHandler handler) {
-  button_down_handler_ = handler;
+  button_down_handler_.primary = handler;
 }
 
 void
 System::RegisterButtonUpHandler(ButtonHandler handler) {
-  button_up_handler_ = handler;
+  button_up_handler_.primary = handler;
 }
 
 void
 System::RegisterAxisMoveHandler(AxisHandler handler) {
-  axis_move_handler_ = handler;
+  axis_move_handler_.primary = handler;
+}
+
+void
+System::RegisterFrameHandler(FrameHandler handler) {
+  frame_handler_.primary = handler;
+}
+
+void
+System::RegisterLogHandler(LogHandler handler, LogLevel max_level) {
+  log_handler_ = handler;
+  log_level_ = max_level;
+}
+
+void
+System::Log(LogLevel level, const std::string& message) {
+  if (IsLogging(level)) {
+    log_handler_(level, message);
+  }
+}
+
+int
+System::AddAttachHandler(AttachedHandler handler) {
+  attached_handler_.added.emplace_back(next_handler_id_, handler);
+  return next_handler_id_++;
+}
+
+int
+System::AddDetachHandler(DetachedHandler handler) {
+  detached_handler_.added.emplace_back(next_handler_id_, handler);
+  return next_handler_id_++;
+}
+
+int
+System::AddButtonDownHandler(ButtonHandler handler) {
+  button_down_handler_.added.emplace_back(next_handler_id_, handler);
+  return next_handler_id_++;
+}
+
+int
+System::AddButtonUpHandler(ButtonHandler handler) {
+  button_up_handler_.added.emplace_back(next_handler_id_, handler);
+  return next_handler_id_++;
+}
+
+int
+System::AddAxisMoveHandler(AxisHandler handler) {
+  axis_move_handler_.added.emplace_back(next_handler_id_, handler);
+  return next_handler_id_++;
+}
+
+int
+System::AddFrameHandler(FrameHandler handler) {
+  frame_handler_.added.emplace_back(next_handler_id_, handler);
+  return next_handler_id_++;
+}
+
+void
+System::RemoveHandler(int handler_id) {
+  // Handler IDs are unique across all lists.
+  RemoveFromList(&attached_handler_, handler_id);
+  RemoveFromList(&detached_handler_, handler_id);
+  RemoveFromList(&button_down_handler_, handler_id);
+  RemoveFromList(&button_up_handler_, handler_id);
+  RemoveFromList(&axis_move_handler_, handler_id);
+  RemoveFromList(&frame_handler_, handler_id);
+}
+
+void
+System::SetAxisFilter(Device* device, int axis_id, const AxisFilter& filter) {
+  device->filters_.SetAxisFilter(axis_id, filter);
+}
+
+void
+System::SetStickDeadZone(Device* device, int x_axis, int y_axis, float inner,
+    float outer) {
+  device->filters_.SetStickDeadZone(x_axis, y_axis, inner, outer);
+  const std::size_t size = std::max(x_axis, y_axis) + 1;
+  if (device->stick_axes_.size() < size) {
+    device->stick_axes_.resize(size, Device::PendingAxis{ 0, 0, nullptr });
+  }
+}
+
+void
+System::ClearFilters(Device* device) {
+  device->filters_.Clear();
+  device->stick_axes_.clear();
+}
+
+void
+System::EnableCoalescing(bool enable) {
+  coalesce_ = enable;
+}
+
+void
+System::SetAxisRateLimit(Device* device, int axis_id, float max_rate) {
+  if (axis_id < 0) {
+    return;
+  }
+  const std::size_t size = axis_id + 1;
+  if (device->axis_intervals_.size() < size) {
+    device->axis_intervals_.resize(size, 0.0);
+    device->axis_call_times_.resize(size,
+        -std::numeric_limits<double>::infinity());
+  }
+  device->axis_intervals_[axis_id] = max_rate > 0.0f ? 1.0 / max_rate : 0.0;
+}
+
+void
+System::SetMappingDatabase(const MappingDatabase& database) {
+  mapping_database_ = database;
+}
+
+const Mapping*
+System::FindMapping(uint16_t bus, uint16_t vendor, uint16_t product,
+    uint16_t version) const {
+  return mapping_database_.Find(bus, vendor, product, version);
+}
+
+void
+System::SetClock(Clock clock) {
+  clock_ = clock;
+}
+
+void
+System::EnableInputThread() {
+}
+
+bool
+System::StartRecording(const std::string&) {
+  return false;
+}
+
+void
+System::StopRecording() {
+}
+
+bool
+System::Rumble(Device*, float, float, double) {
+  return false;
+}
+
+int
+System::GetPollDescriptor() {
+  return -1;
+}
+
+void
+System::EnableMetrics(bool enable) {
+  metrics_enabled_ = enable;
+}
+
+void
+System::GetMetrics(Metrics* metrics) const {
+  metrics->devices.clear();
+  for (const Device* device : attached_devices_) {
+    metrics->devices.push_back(device->metrics_);
+    metrics->devices.back().device_id = device->device_id;
+  }
+  metrics->processing_time = processing_time_;
+}
+
+void
+System::ResetMetrics() {
+  for (Device* device : attached_devices_) {
+    device->metrics_ = DeviceMetrics();
+  }
+  processing_time_.Reset();
+}
+
+bool
+System::GetSnapshot(unsigned int device_id, Snapshot* snapshot) const {
+  return snapshots_.Load(device_id, snapshot);
+}
+
+bool
+System::StartPublishing(const std::string& name) {
+  if (!shared_snapshots_.Create(name)) {
+    return false;
+  }
+  shared_snapshots_.Table()->CopyFrom(snapshots_);
+  return true;
+}
+
+void
+System::StopPublishing() {
+  shared_snapshots_.Close();
+}
+
+void
+System::HandleAttach(Device* device) {
+  // Assign a free snapshot slot and publish the initial state.
+  device->snapshot_slot_ = snapshots_.FindFreeSlot();
+  if (device->snapshot_slot_ >= 0) {
+    device->snapshot_sequence_ = 0;
+    PublishSnapshot(device);
+    snapshots_.SetOwner(device->snapshot_slot_, device->device_id);
+    if (shared_snapshots_.IsOpen()) {
+      shared_snapshots_.Table()->SetOwner(device->snapshot_slot_,
+          device->device_id);
+    }
+  }
+  device->metrics_ = DeviceMetrics();
+  ClearFilters(device);
+  device->axis_intervals_.clear();
+  device->axis_call_times_.clear();
+  attached_devices_.push_back(device);
+  if (attached_handler_) {
+    attached_handler_(device);
+  }
+}
+
+void
+System::HandleDetach(Device* device) {
+  if (detached_handler_) {
+    detached_handler_(device);
+  }
+  // Release the snapshot slot. Readers verify the device ID of the state.
+  if (device->snapshot_slot_ >= 0) {
+    snapshots_.ClearOwner(device->snapshot_slot_);
+    snapshots_.Store(device->snapshot_slot_, Snapshot());
+    if (shared_snapshots_.IsOpen()) {
+      shared_snapshots_.Table()->ClearOwner(device->snapshot_slot_);
+      shared_snapshots_.Table()->Store(device->snapshot_slot_, Snapshot());
+    }
+    device->snapshot_slot_ = -1;
+  }
+  attached_devices_.erase(std::remove(attached_devices_.begin(),
+      attached_devices_.end(), device), attached_devices_.end());
+  if (device->has_edges_) {
+    edge_devices_.erase(std::remove(edge_devices_.begin(),
+        edge_devices_.end(), device), edge_devices_.end());
+    device->has_edges_ = false;
+  }
+  if (device->has_coalesced_) {
+    coalesced_devices_.erase(std::remove(coalesced_devices_.begin(),
+        coalesced_devices_.end(), device), coalesced_devices_.end());
+    device->has_coalesced_ = false;
+  }
+  device->coalesced_axes_.clear();
 }
 
 void
-System::HandleButtonEvent(Device* device, int button_id, int value) {
+System::HandleButtonEvent(Device* device, int button_id, int value,
+    double timestamp) {
   const bool is_down = value > 0;
   device->buttons[button_id] = is_down;
-  if (is_down && button_down_handler_) {
-    button_down_handler_(device, button_id, 0.0);
+  if (button_id < ButtonBits::kMaxButtons) {
+    UpdateButtonBits(device, button_id, is_down);
+  }
+  if (visitor_ != nullptr) {
+    if (metrics_enabled_) {
+      RecordLatency(device, timestamp);
+    }
+    (is_down ? visitor_calls_->button_down : visitor_calls_->button_up)(
+        visitor_, device, button_id, timestamp);
+  } else if (frame_handler_) {
+    Frame& frame = device->frame_;
+    frame.timestamp = timestamp;
+    (is_down ? frame.pressed_buttons : frame.released_buttons)
+        .push_back(button_id);
+  } else if (is_down && button_down_handler_) {
+    if (metrics_enabled_) {
+      RecordLatency(device, timestamp);
+    }
+    button_down_handler_(device, button_id, timestamp);
   } else if (!is_down && button_up_handler_) {
-    button_up_handler_(device, button_id, 0.0);
+    if (metrics_enabled_) {
+      RecordLatency(device, timestamp);
+    }
+    button_up_handler_(device, button_id, timestamp);
   }
 }
 
 void
 System::HandleAxisEvent(Device* device, int axis_id, int value,
-    int min, int max, int fuzz, int flat) {
-  // Flatten value. Values within flat-range will be reported as zero.
-  value = value > -flat && value < flat ? 0 : value;
-  // Normalize value and camp value to [-1, 1].
-  const float minimum = static_cast<float>(min);
-  const float maximum = static_cast<float>(max);
-  const float range = maximum - minimum;
-  const float norm = (static_cast<float>(value) - minimum) / range;
-  const float clamped = std::max(-1.0f, std::min(1.0f, 2.0f * norm - 1.0f));
+    const AxisTransform& transform, double timestamp) {
+  // Collect the raw value. If an axis is reported more than once, the last
+  // value wins.
+  device->frame_.timestamp = timestamp;
+  for (Device::PendingAxis& pending : device->pending_axes_) {
+    if (pending.axis_id == axis_id) {
+      pending.value = value;
+      return;
+    }
+  }
+  Device::PendingAxis pending;
+  pending.axis_id = axis_id;
+  pending.value = value;
+  pending.transform = &transform;
+  device->pending_axes_.push_back(pending);
+}
+
+void
+System::HandleAxisBatch(Device* device) {
+  if (device->pending_axes_.empty()) {
+    return;
+  }
+  const bool has_filters = !device->filters_.Empty();
+  if (has_filters && !device->stick_axes_.empty()) {
+    AddStickAxes(device);
+  }
+
+  // Gather the values and transforms and normalize them in one batch. The
+  // radial dead zone of a stick replaces the flat value of its axes.
+  const std::size_t count = device->pending_axes_.size();
+  batch_values_.resize(count);
+  batch_flats_.resize(count);
+  batch_scales_.resize(count);
+  batch_offsets_.resize(count);
+  batch_results_.resize(count);
+  batch_axis_ids_.resize(count);
+  batch_eps_.resize(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const Device::PendingAxis& pending = device->pending_axes_[i];
+    batch_values_[i] = pending.value;
+    batch_flats_[i] = pending.transform->flat;
+    batch_scales_[i] = pending.transform->scale;
+    batch_offsets_[i] = pending.transform->offset;
+    batch_axis_ids_[i] = pending.axis_id;
+    batch_eps_[i] = pending.transform->eps;
+  }
+  if (has_filters) {
+    for (std::size_t i = 0; i < count; ++i) {
+      if (device->filters_.StickPartner(batch_axis_ids_[i]) >= 0) {
+        batch_flats_[i] = 0;
+      }
+    }
+  }
+  NormalizeAxes(batch_values_.data(), batch_scales_.data(),
+      batch_offsets_.data(), batch_flats_.data(), batch_results_.data(),
+      count);
+  if (has_filters) {
+    device->filters_.Apply(batch_axis_ids_.data(), batch_results_.data(),
+        count, device->frame_.timestamp);
+  }
+  device->pending_axes_.clear();
+  DispatchAxes(device);
+}
+
+void
+System::AddStickAxes(Device* device) {
+  // Remember the raw values of stick axes, then add the other axis of each
+  // stick that is not part of the report, using its last raw value.
+  std::vector<Device::PendingAxis>& pending_axes = device->pending_axes_;
+  std::vector<Device::PendingAxis>& stick_axes = device->stick_axes_;
+  const std::size_t count = pending_axes.size();
+  for (std::size_t i = 0; i < count; ++i) {
+    const int axis_id = pending_axes[i].axis_id;
+    if (axis_id < static_cast<int>(stick_axes.size())) {
+      stick_axes[axis_id] = pending_axes[i];
+    }
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    const int partner = device->filters_.StickPartner(pending_axes[i].axis_id);
+    if (partner < 0 || stick_axes[partner].transform == nullptr) {
+      continue;
+    }
+    bool found = false;
+    for (const Device::PendingAxis& pending : pending_axes) {
+      found = found || pending.axis_id == partner;
+    }
+    if (!found) {
+      pending_axes.push_back(stick_axes[partner]);
+    }
+  }
+}
+
+void
+System::DispatchAxes(Device* device) {
   // Send an update if the new value is different from the last value. Use an
   // epsilon comparison to the last value based on the fuzz value.
-  const float last = device->axes[axis_id];
-  const float eps = static_cast<float>(2 * fuzz) / range;
-  if (clamped > last + eps || clamped < last - eps) {
-    device->axes[axis_id] = clamped;
-    if (axis_move_handler_) {
-      axis_move_handler_(device, axis_id, clamped, last, 0.0);
+  Frame& frame = device->frame_;
+  const std::size_t count = batch_axis_ids_.size();
+  for (std::size_t i = 0; i < count; ++i) {
+    const int axis_id = batch_axis_ids_[i];
+    const float value = batch_results_[i];
+    const float last = device->axes[axis_id];
+    const float eps = batch_eps_[i];
+    if (value > last + eps || value < last - eps) {
+      device->axes[axis_id] = value;
+      if (frame_handler_ && visitor_ == nullptr) {
+        // A coalesced frame may see an axis change in several reports.
+        std::vector<int>& changed = frame.changed_axes;
+        if (!coalesce_ ||
+            std::find(changed.begin(), changed.end(), axis_id) ==
+            changed.end()) {
+          changed.push_back(axis_id);
+        }
+      } else if (coalesce_) {
+        CoalesceAxis(device, axis_id, last, frame.timestamp);
+      } else {
+        EmitAxisMove(device, axis_id, value, last, frame.timestamp);
+      }
+    } else if (metrics_enabled_) {
+      device->metrics_.events_filtered += 1;
+    }
+  }
+}
+
+void
+System::EmitAxisMove(Device* device, int axis_id, float value,
+    float old_value, double timestamp) {
+  if (visitor_ != nullptr) {
+    if (metrics_enabled_) {
+      RecordLatency(device, timestamp);
+    }
+    visitor_calls_->axis_move(visitor_, device, axis_id, value, old_value,
+        timestamp);
+  } else if (axis_move_handler_) {
+    if (metrics_enabled_) {
+      RecordLatency(device, timestamp);
+    }
+    axis_move_handler_(device, axis_id, value, old_value, timestamp);
+  }
+}
+
+void
+System::SettleAxes(Device* device, double timestamp) {
+  // Report the settling values like a report of the device. Every change is
+  // reported, the fuzz value does not apply.
+  batch_axis_ids_.clear();
+  batch_results_.clear();
+  device->filters_.Settle(timestamp, &batch_axis_ids_, &batch_results_);
+  batch_eps_.assign(batch_axis_ids_.size(), 0.0f);
+  device->frame_.timestamp = timestamp;
+  DispatchAxes(device);
+  HandleReport(device);
+}
+
+void
+System::HandleReport(Device* device) {
+  HandleAxisBatch(device);
+  PublishSnapshot(device);
+  if (coalesce_ && frame_handler_ && visitor_ == nullptr) {
+    // The frame is delivered at the end of the pass.
+    AddCoalescedDevice(device);
+    return;
+  }
+  DeliverFrame(device);
+}
+
+void
+System::DeliverFrame(Device* device) {
+  Frame& frame = device->frame_;
+  if (frame_handler_ && visitor_ == nullptr) {
+    // A re-sync reports the complete device state.
+    if (frame.full_state) {
+      frame.changed_axes.clear();
+      frame.pressed_buttons.clear();
+      frame.released_buttons.clear();
+      for (std::size_t i = 0; i < device->axes.size(); ++i) {
+        frame.changed_axes.push_back(i);
+      }
+      for (std::size_t i = 0; i < device->buttons.size(); ++i) {
+        (device->buttons[i] ? frame.pressed_buttons : frame.released_buttons)
+            .push_back(i);
+      }
+    }
+    // Only deliver frames with changes.
+    if (frame.full_state || !frame.changed_axes.empty() ||
+        !frame.pressed_buttons.empty() || !frame.released_buttons.empty()) {
+      frame.device = device;
+      if (metrics_enabled_) {
+        RecordLatency(device, frame.timestamp);
+      }
+      frame_handler_(frame);
     }
   }
+  // Clear the frame but keep the memory for the next report.
+  frame.full_state = false;
+  frame.changed_axes.clear();
+  frame.pressed_buttons.clear();
+  frame.released_buttons.clear();
+}
+
+void
+System::HandleResync(Device* device) {
+  device->frame_.full_state = true;
+  if (metrics_enabled_) {
+    device->metrics_.resyncs += 1;
+  }
+}
+
+void
+System::HandleReadError(Device* device) {
+  if (metrics_enabled_) {
+    device->metrics_.read_errors += 1;
+  }
+}
+
+void
+System::BeginProcessing() {
+  // Only devices with edges in the previous pass need to be cleared.
+  for (Device* device : edge_devices_) {
+    device->pressed_this_frame.Clear();
+    device->released_this_frame.Clear();
+    device->has_edges_ = false;
+  }
+  edge_devices_.clear();
+  if (metrics_enabled_) {
+    processing_start_ = SteadyTime();
+  }
+}
+
+void
+System::CoalesceAxis(Device* device, int axis_id, float old_value,
+    double timestamp) {
+  // Keep the old value of the first change within the pass.
+  for (Device::CoalescedAxis& coalesced : device->coalesced_axes_) {
+    if (coalesced.axis_id == axis_id) {
+      coalesced.timestamp = timestamp;
+      return;
+    }
+  }
+  device->coalesced_axes_.push_back(
+      Device::CoalescedAxis{ axis_id, old_value, timestamp });
+  AddCoalescedDevice(device);
+}
+
+void
+System::AddCoalescedDevice(Device* device) {
+  if (!device->has_coalesced_) {
+    device->has_coalesced_ = true;
+    coalesced_devices_.push_back(device);
+  }
+}
+
+void
+System::FlushCoalesced() {
+  // Devices with rate limited axes that are not due yet stay in the list.
+  double now = -1.0;
+  std::size_t num_devices = 0;
+  for (Device* device : coalesced_devices_) {
+    if (frame_handler_ && visitor_ == nullptr) {
+      DeliverFrame(device);
+      device->coalesced_axes_.clear();
+      device->has_coalesced_ = false;
+      continue;
+    }
+    std::vector<Device::CoalescedAxis>& axes = device->coalesced_axes_;
+    const int num_intervals = device->axis_intervals_.size();
+    std::size_t num_delayed = 0;
+    for (const Device::CoalescedAxis& coalesced : axes) {
+      const int axis_id = coalesced.axis_id;
+      if (axis_id < num_intervals && device->axis_intervals_[axis_id] > 0.0) {
+        if (now < 0.0) {
+          now = CurrentTime();
+        }
+        if (now < device->axis_call_times_[axis_id] +
+            device->axis_intervals_[axis_id]) {
+          axes[num_delayed++] = coalesced;
+          continue;
+        }
+        device->axis_call_times_[axis_id] = now;
+      }
+      // An axis that returned to its old value did not change.
+      const float value = device->axes[axis_id];
+      if (value != coalesced.old_value) {
+        EmitAxisMove(device, axis_id, value, coalesced.old_value,
+            coalesced.timestamp);
+      }
+    }
+    axes.resize(num_delayed);
+    if (num_delayed > 0) {
+      coalesced_devices_[num_devices++] = device;
+    } else {
+      device->has_coalesced_ = false;
+    }
+  }
+  coalesced_devices_.resize(num_devices);
+}
+
+void
+System::EndProcessing() {
+  for (Device* device : attached_devices_) {
+    if (device->filters_.Settling()) {
+      SettleAxes(device, CurrentTime());
+    }
+  }
+  if (!coalesced_devices_.empty()) {
+    FlushCoalesced();
+  }
+  if (metrics_enabled_) {
+    processing_time_.Add(SteadyTime() - processing_start_);
+  }
+}
+
+double
+System::CurrentTime() const {
+  return SteadyTime();
+}
+
+int
+System::WaitTimeout(int timeout_ms) const {
+  int result = timeout_ms;
+  const auto shorten = [&result](int delay_ms) {
+    if (result < 0 || delay_ms < result) {
+      result = delay_ms;
+    }
+  };
+  for (const Device* device : attached_devices_) {
+    if (device->filters_.Settling()) {
+      shorten(kSettleIntervalMs);
+      break;
+    }
+  }
+  // Only axes that are delayed by a rate limit remain after a pass.
+  if (!coalesced_devices_.empty()) {
+    const double now = CurrentTime();
+    for (const Device* device : coalesced_devices_) {
+      for (const Device::CoalescedAxis& coalesced : device->coalesced_axes_) {
+        const double due = device->axis_call_times_[coalesced.axis_id] +
+            device->axis_intervals_[coalesced.axis_id];
+        shorten(static_cast<int>(std::max(0.0, std::ceil((due - now) * 1e3))));
+      }
+    }
+  }
+  return result;
+}
+
+void
+System::RecordLatency(Device* device, double timestamp) {
+  device->metrics_.handler_latency.Add(CurrentTime() - timestamp);
+}
+
+void
+System::UpdateButtonBits(Device* device, int button_id, bool is_down) {
+  const int word = button_id / 64;
+  const uint64_t bit = uint64_t(1) << (button_id % 64);
+  // The changed bit, or zero if the state did not change.
+  const uint64_t changed =
+      (device->button_bits.words[word] & bit) ^ (is_down ? bit : 0);
+  if (changed == 0) {
+    return;
+  }
+  device->button_bits.words[word] ^= changed;
+  ButtonBits& edges = is_down ? device->pressed_this_frame
+      : device->released_this_frame;
+  edges.words[word] |= changed;
+  if (!device->has_edges_) {
+    device->has_edges_ = true;
+    edge_devices_.push_back(device);
+  }
+}
+
+void
+System::PublishSnapshot(Device* device) {
+  if (device->snapshot_slot_ < 0) {
+    return;
+  }
+  Snapshot snapshot;
+  snapshot.device_id = device->device_id;
+  snapshot.sequence = ++device->snapshot_sequence_;
+  snapshot.timestamp = device->frame_.timestamp;
+  snapshot.num_axes = std::min<int>(device->axes.size(), Snapshot::kMaxAxes);
+  snapshot.num_buttons =
+      std::min<int>(device->buttons.size(), Snapshot::kMaxButtons);
+  for (int i = 0; i < snapshot.num_axes; ++i) {
+    snapshot.axes[i] = device->axes[i];
+  }
+  // The button bits match the snapshot layout.
+  static_assert(Snapshot::kMaxButtons == ButtonBits::kMaxButtons,
+      "Snapshot and ButtonBits sizes differ");
+  for (int i = 0; i < ButtonBits::kNumWords; ++i) {
+    snapshot.buttons[i] = device->button_bits.words[i];
+  }
+  snapshots_.Store(device->snapshot_slot_, snapshot);
+  if (shared_snapshots_.IsOpen()) {
+    shared_snapshots_.Table()->Store(device->snapshot_slot_, snapshot);
+  }
 }
 
 }  // namespace gamepad
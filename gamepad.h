@@ -5,20 +5,235 @@
 #ifndef GAMEPAD_HEADER
 #define GAMEPAD_HEADER
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "gamepad_axis.h"
+#include "gamepad_filter.h"
+#include "gamepad_mapping.h"
+#include "gamepad_metrics.h"
+#include "gamepad_snapshot.h"
+
 namespace gamepad {
 
+struct Device;
+
+// Identifies an attached device. Storage of detached devices is re-used for
+// new devices, and the generation tells whether the handle is stale.
+struct DeviceHandle {
+  uint32_t index = 0;
+  uint32_t generation = 0;
+};
+
+// Button states as a fixed-width bitset, one bit per button ID. Queries
+// over all buttons, like chords, take a few word operations.
+struct ButtonBits {
+  static constexpr int kMaxButtons = 128;
+  static constexpr int kNumWords = kMaxButtons / 64;
+
+  uint64_t words[kNumWords] = {};
+
+  bool Test(int button_id) const {
+    return (words[button_id / 64] >> (button_id % 64)) & 1;
+  }
+  void Set(int button_id) {
+    words[button_id / 64] |= uint64_t(1) << (button_id % 64);
+  }
+  void Reset(int button_id) {
+    words[button_id / 64] &= ~(uint64_t(1) << (button_id % 64));
+  }
+  void Clear() {
+    for (int i = 0; i < kNumWords; ++i) {
+      words[i] = 0;
+    }
+  }
+  // Returns true if any button is set.
+  bool Any() const {
+    uint64_t any = 0;
+    for (int i = 0; i < kNumWords; ++i) {
+      any |= words[i];
+    }
+    return any != 0;
+  }
+  // Returns true if all buttons of the mask are set, e.g., for a chord.
+  bool All(const ButtonBits& mask) const {
+    uint64_t missing = 0;
+    for (int i = 0; i < kNumWords; ++i) {
+      missing |= mask.words[i] & ~words[i];
+    }
+    return missing == 0;
+  }
+  // Returns true if any button of the mask is set.
+  bool AnyOf(const ButtonBits& mask) const {
+    uint64_t any = 0;
+    for (int i = 0; i < kNumWords; ++i) {
+      any |= mask.words[i] & words[i];
+    }
+    return any != 0;
+  }
+};
+
+// A frame collects all changes of a device that were reported together by
+// the device (on Linux, all events between two SYN_REPORTs).
+struct Frame {
+  Device* device = nullptr;
+  // Timestamp of the report in seconds, see System::SetClock().
+  double timestamp = 0.0;
+  // Set if events have been dropped and the device state has been re-synced.
+  // In this case, all axes are listed as changed and every button is listed
+  // as either pressed or released.
+  bool full_state = false;
+  // IDs of changed axes, and of buttons that went down or up.
+  std::vector<int> changed_axes;
+  std::vector<int> pressed_buttons;
+  std::vector<int> released_buttons;
+};
+
+// Device pointers passed to the handlers remain valid (but possibly re-used
+// for another device) until the System is destroyed. Use the handle with
+// System::GetDevice() to check if a cached device is still attached.
 struct Device {
+  DeviceHandle handle;
   unsigned int device_id = 0;
   int vendor_id = 0;
   int product_id = 0;
   std::string description;
+  // True if buttons and axes are numbered like StandardLayout, see
+  // System::SetMappingDatabase().
+  bool standard_layout = false;
+  // True if the device supports System::Rumble().
+  bool has_rumble = false;
   std::vector<float> axes;
+  // The button states, one entry per button. Kept for compatibility, the
+  // bitsets below are cheaper to query.
   std::vector<bool> buttons;
+  // The button states of the first ButtonBits::kMaxButtons buttons.
+  ButtonBits button_bits;
+  // The buttons that went down and up during the current ProcessEvents()
+  // or WaitForEvents() call. A button that is tapped within the call is set
+  // in both. Cleared when the next call starts processing.
+  ButtonBits pressed_this_frame;
+  ButtonBits released_this_frame;
+
+ private:
+  friend class System;
+  // A raw axis value of the current report.
+  struct PendingAxis {
+    int axis_id;
+    int value;
+    const AxisTransform* transform;
+  };
+  // The frame that is currently being collected.
+  Frame frame_;
+  // Axis values of the current report, normalized in one batch.
+  std::vector<PendingAxis> pending_axes_;
+  // The filters of the axes, see System::SetAxisFilter().
+  AxisFilterBank filters_;
+  // The last raw values of stick axes with a radial dead zone, indexed by
+  // axis ID, to add the other axis of the stick to a report.
+  std::vector<PendingAxis> stick_axes_;
+  // An axis change that is delivered at the end of the processing pass,
+  // see System::EnableCoalescing().
+  struct CoalescedAxis {
+    int axis_id;
+    float old_value;
+    double timestamp;
+  };
+  std::vector<CoalescedAxis> coalesced_axes_;
+  // Set while the device is in the list of devices with coalesced changes.
+  bool has_coalesced_ = false;
+  // The minimum interval between axis move calls per axis ID, and the time
+  // of the last call, see System::SetAxisRateLimit().
+  std::vector<double> axis_intervals_;
+  std::vector<double> axis_call_times_;
+  // Snapshot slot of the device, or -1 if all slots are in use.
+  int snapshot_slot_ = -1;
+  uint64_t snapshot_sequence_ = 0;
+  // Set while the device is in the list of devices with edges to clear.
+  bool has_edges_ = false;
+  // Collected while metrics are enabled.
+  DeviceMetrics metrics_;
+};
+
+// A decoded button or axis event, see EventStream in gamepad_coro.h.
+struct Event {
+  enum Type { kButtonDown, kButtonUp, kAxisMove };
+
+  Type type = kButtonDown;
+  Device* device = nullptr;
+  // The button or axis ID.
+  int id = 0;
+  // The new and old axis value, unused for buttons.
+  float value = 0.0f;
+  float old_value = 0.0f;
+  double timestamp = 0.0;
+};
+
+// The handlers for one event type: The handler set with System::Register*()
+// and the handlers added with System::Add*(). Calling the list invokes all
+// of them in this order.
+template <typename Handler>
+struct HandlerList {
+  Handler primary;
+  std::vector<std::pair<int, Handler>> added;
+
+  explicit operator bool() const {
+    return static_cast<bool>(primary) || !added.empty();
+  }
+
+  template <typename... Args>
+  void operator()(Args&&... args) const {
+    if (primary) {
+      primary(args...);
+    }
+    for (const auto& entry : added) {
+      entry.second(args...);
+    }
+  }
+};
+
+// The members of a visitor of System::ProcessEvents(Visitor&) as plain
+// functions of the visitor object. The functions are instantiated for the
+// visitor type, so the members are resolved statically and inlined into
+// them, and an event costs a single indirect call.
+struct VisitorCalls {
+  void (*button_down)(void* visitor, Device* device, int button_id,
+      double timestamp);
+  void (*button_up)(void* visitor, Device* device, int button_id,
+      double timestamp);
+  void (*axis_move)(void* visitor, Device* device, int axis_id, float value,
+      float old_value, double timestamp);
+};
+
+template <typename Visitor>
+struct VisitorThunks {
+  static void ButtonDown(void* visitor, Device* device, int button_id,
+      double timestamp) {
+    static_cast<Visitor*>(visitor)->OnButtonDown(device, button_id,
+        timestamp);
+  }
+  static void ButtonUp(void* visitor, Device* device, int button_id,
+      double timestamp) {
+    static_cast<Visitor*>(visitor)->OnButtonUp(device, button_id, timestamp);
+  }
+  static void AxisMove(void* visitor, Device* device, int axis_id,
+      float value, float old_value, double timestamp) {
+    static_cast<Visitor*>(visitor)->OnAxisMove(device, axis_id, value,
+        old_value, timestamp);
+  }
+
+  static const VisitorCalls kCalls;
+};
+
+template <typename Visitor>
+const VisitorCalls VisitorThunks<Visitor>::kCalls = {
+  &VisitorThunks<Visitor>::ButtonDown,
+  &VisitorThunks<Visitor>::ButtonUp,
+  &VisitorThunks<Visitor>::AxisMove,
 };
 
 class System {
@@ -27,13 +242,40 @@ class System {
   typedef std::function<void(Device*)> AttachedHandler;
   // The detached handler signature.
   typedef std::function<void(Device*)> DetachedHandler;
-  // The button handler signature (device, button ID, timestamp).
+  // The button handler signature (device, button ID, timestamp). Timestamps
+  // are in seconds, see SetClock().
   typedef std::function<void(Device*, int, double)> ButtonHandler;
   // The axis handler signature (device, axis ID, value, old value, timestamp).
   typedef std::function<void(Device*, int, float, float, double)> AxisHandler;
+  // The frame handler signature.
+  typedef std::function<void(const Frame&)> FrameHandler;
+
+  // The verbosity of diagnostic messages. Info messages summarize attached
+  // devices, debug messages list all capabilities of a device.
+  enum class LogLevel { kInfo, kDebug };
+  // The log handler signature (level, message).
+  typedef std::function<void(LogLevel, const std::string&)> LogHandler;
+
+  // The clock that event timestamps are taken from.
+  enum class Clock { kMonotonic, kRealtime };
+
+  // Creates a system for a named backend, see System::Create().
+  typedef std::function<std::unique_ptr<System>()> BackendFactory;
+
+  // The number of devices that state snapshots are published for.
+  static constexpr int kMaxSnapshotDevices = SnapshotTable::kNumSlots;
 
  public:
+  // Creates the system for the devices of the platform.
   static std::unique_ptr<System> Create();
+  // Creates the system of a named backend. Built-in backends are "native",
+  // which is the same as Create(), and "synthetic", which generates input
+  // of simulated devices, see SyntheticSystem. Returns nullptr if the name
+  // is unknown.
+  static std::unique_ptr<System> Create(const std::string& backend);
+  // Registers a backend for Create(). Replaces a backend of the same name.
+  static void RegisterBackend(const std::string& name,
+      BackendFactory factory);
   virtual ~System() = default;
 
   // Registers a handler that is called when a pad is attached.
@@ -46,29 +288,320 @@ class System {
   void RegisterButtonUpHandler(ButtonHandler handler);
   // Registers a handler for axis move events.
   void RegisterAxisMoveHandler(AxisHandler handler);
+  // Registers a handler that receives all changes of a device report in a
+  // single frame. While a frame handler is registered, the button and axis
+  // handlers are not invoked. Register an empty handler to disable.
+  void RegisterFrameHandler(FrameHandler handler);
+  // Registers a handler for diagnostic messages up to the given verbosity.
+  // Without a log handler, no messages are generated. Errors are always
+  // printed to stderr.
+  // Linux: Attached devices are logged.
+  // MacOS: No messages, devices are attached on the event thread.
+  void RegisterLogHandler(LogHandler handler,
+      LogLevel max_level = LogLevel::kInfo);
+
+  // Adds a handler in addition to the registered one and to previously added
+  // handlers. Returns an ID to remove the handler with RemoveHandler().
+  // Handlers must not be added or removed from within a handler.
+  int AddAttachHandler(AttachedHandler handler);
+  int AddDetachHandler(DetachedHandler handler);
+  int AddButtonDownHandler(ButtonHandler handler);
+  int AddButtonUpHandler(ButtonHandler handler);
+  int AddAxisMoveHandler(AxisHandler handler);
+  int AddFrameHandler(FrameHandler handler);
+  // Removes a handler added with one of the Add*() functions.
+  void RemoveHandler(int handler_id);
+
+  // Reads device input on a background thread so that input is not lost
+  // while the caller is busy. ProcessEvents() and WaitForEvents() then only
+  // dispatch the queued input on the calling thread.
+  // MacOS: Input is always read on a background thread.
+  virtual void EnableInputThread();
+
+  // Copies the state of the device as of the end of its last report. Can be
+  // called from any thread without blocking event processing. Returns false
+  // if the device is not attached, or in the rare case that the state is
+  // being written for too long, see SnapshotTable::kMaxLoadAttempts. State
+  // is published for the first kMaxSnapshotDevices attached devices only.
+  bool GetSnapshot(unsigned int device_id, Snapshot* snapshot) const;
+  // Additionally publishes the device states to a POSIX shared memory
+  // segment with the name, e.g., "/gamepad", so that other processes can
+  // read them with a StateReader instead of opening the devices. Returns
+  // false if the segment cannot be created. Must be called from the thread
+  // that processes events.
+  bool StartPublishing(const std::string& name);
+  // Stops publishing and removes the segment.
+  void StopPublishing();
+
+  // Records the raw input of all devices, including the devices attached
+  // at this time, to a file that can be replayed with ReplaySystem. Returns
+  // false if the file cannot be created or if recording is not supported.
+  // Linux: Supported.
+  // MacOS: Not supported.
+  virtual bool StartRecording(const std::string& filename);
+  // Stops recording and closes the file.
+  virtual void StopRecording();
+
+  // Lets the strong (low-frequency) and the weak (high-frequency) motor of
+  // the device rumble with magnitudes in [0, 1] for the duration in
+  // seconds, at most 65 seconds. A new rumble replaces the current one,
+  // magnitudes or a duration of zero stop it. The effect is uploaded to
+  // the device once and only updated if its parameters change, so rumble
+  // can be repeated every frame. Returns false if the device does not
+  // support rumble, see Device::has_rumble, or on error.
+  // Linux: Supported if the device file is writable, see the README.
+  // MacOS: Not supported.
+  virtual bool Rumble(Device* device, float strong, float weak,
+      double duration);
+
+  // Enables or disables the collection of metrics. Metrics are disabled by
+  // default, which costs a branch per event. Enabled metrics additionally
+  // read the clock once per handler invocation and per processing call.
+  void EnableMetrics(bool enable);
+  // Copies the metrics of the attached devices and of event processing.
+  // Must be called from the thread that processes events.
+  void GetMetrics(Metrics* metrics) const;
+  // Resets all metrics to zero.
+  void ResetMetrics();
+
+  // Sets the filter of an axis of the device, see AxisFilter. Filters apply
+  // to the normalized values before they are compared with the last value
+  // and passed to the handlers. Configure filters in the attach handler,
+  // they are removed when the device is detached. Smoothed values settle
+  // towards the last input on the following ProcessEvents() and
+  // WaitForEvents() calls, even without new input.
+  void SetAxisFilter(Device* device, int axis_id, const AxisFilter& filter);
+  // Sets a radial dead zone for the stick formed by two axes of the device,
+  // see AxisFilterBank::SetStickDeadZone(). It replaces the dead zone
+  // reported by the device for both axes.
+  void SetStickDeadZone(Device* device, int x_axis, int y_axis, float inner,
+      float outer = 1.0f);
+  // Removes all filters of the device.
+  void ClearFilters(Device* device);
+
+  // Coalesces axis changes within each ProcessEvents() or WaitForEvents()
+  // call, so that handler calls stay bounded for devices that flood axis
+  // events. Changed axes are passed to the handlers once at the end of the
+  // call with their last value, while button events are still delivered
+  // as they occur. With a frame handler, all reports of a device within
+  // the call are delivered as a single frame that lists every button edge.
+  void EnableCoalescing(bool enable);
+  // Limits the axis move calls for an axis of the device to max_rate per
+  // second while coalescing is enabled. Changes within the interval are
+  // delayed, and the last value is always delivered: WaitForEvents() wakes
+  // up for it. A rate of zero removes the limit. Limits are removed when the
+  // device is detached. Frame handlers are not rate limited.
+  void SetAxisRateLimit(Device* device, int axis_id, float max_rate);
+
+  // Reports the buttons and axes of devices with a mapping in the database
+  // in the standard layout, see StandardLayout. The database is copied and
+  // applies to devices attached afterwards. Mappings are resolved into the
+  // lookup tables of the device once at attach time.
+  // Linux: Supported. Recordings keep the buttons and axes of the device.
+  // MacOS: Not supported, devices keep their layout.
+  void SetMappingDatabase(const MappingDatabase& database);
+
+  // Returns the device for the handle in O(1), or nullptr if the device has
+  // been detached.
+  virtual Device* GetDevice(DeviceHandle handle) = 0;
+
+  // Selects the clock for the timestamps passed to the handlers. Timestamps
+  // are the time the event was generated by the kernel, in seconds.
+  // Linux: The default is CLOCK_MONOTONIC, which matches the clock of
+  //   std::chrono::steady_clock. The clock is set on each device using
+  //   EVIOCSCLOCKID.
+  // MacOS: Always uses mach_absolute_time(), the clock cannot be changed.
+  virtual void SetClock(Clock clock);
 
   // Processes all events and invokes the corresponding handler functions.
   virtual void ProcessEvents() = 0;
 
+  // Processes all events like ProcessEvents(), but passes button and axis
+  // events to the visitor instead of the handler functions. The visitor is
+  // called while the events are processed, in the same order and at the
+  // same points as the handlers, but without the overhead of std::function
+  // and the handler lists. The visitor must provide the following member
+  // functions:
+  //   void OnButtonDown(Device* device, int button_id, double timestamp);
+  //   void OnButtonUp(Device* device, int button_id, double timestamp);
+  //   void OnAxisMove(Device* device, int axis_id, float value,
+  //       float old_value, double timestamp);
+  // Attach and detach events are still passed to the handlers. Subclasses
+  // keep this overload visible with "using System::ProcessEvents;".
+  template <typename Visitor>
+  void ProcessEvents(Visitor& visitor);
+
+  // Blocks until events are available or the timeout (in milliseconds)
+  // expires, then processes all events like ProcessEvents(). A negative
+  // timeout blocks until events arrive. Use this instead of calling
+  // ProcessEvents() in a sleep loop to avoid adding the sleep interval
+  // to the input latency. On Linux, this also wakes up and handles device
+  // hotplug once ScanForDevices() has been called.
+  virtual void WaitForEvents(int timeout_ms) = 0;
+
+  // Waits like WaitForEvents() and dispatches like ProcessEvents(Visitor&).
+  template <typename Visitor>
+  void WaitForEvents(int timeout_ms, Visitor& visitor);
+
+  // Returns a descriptor that becomes readable when events are pending, to
+  // wait in an external event loop instead of in WaitForEvents(), or -1.
+  // Call ProcessEvents() once it is readable, and at the latest after
+  // GetPollTimeout() milliseconds. See also EventStream in gamepad_coro.h.
+  // Linux: The epoll descriptor of the devices and of device hotplug.
+  // MacOS: Not supported.
+  virtual int GetPollDescriptor();
+  // Returns the time in milliseconds after which ProcessEvents() must be
+  // called even without input, for delayed axis changes and settling
+  // filters, or -1 if there is no such deadline.
+  int GetPollTimeout() const { return WaitTimeout(-1); }
+
   // Scans for new devices and invokes the attach handler for each new device.
   // The cost of this call depends on the implementation.
   // MacOS: Essentially free, devices are attached using IOKit callbacks.
-  // Linux: Needs to scan /dev/input for devices not already attached.
+  // The attach and detach handlers are called by the next ProcessEvents().
+  // Linux: Scans /dev/input once, then attaches and detaches devices based
+  // on inotify events. Essentially free if nothing has changed.
   virtual void ScanForDevices() = 0;
 
  protected:
   System() = default;
-  void HandleButtonEvent(Device* device, int button_id, int value);
+  // Notifies the system and the client of an attached or detached device.
+  void HandleAttach(Device* device);
+  void HandleDetach(Device* device);
+  void HandleButtonEvent(Device* device, int button_id, int value,
+      double timestamp);
+  // Axis values are normalized when the report ends. The transform must
+  // remain valid until then.
   void HandleAxisEvent(Device* device, int axis_id, int value,
-      int min, int max, int fuzz, int flat);
+      const AxisTransform& transform, double timestamp);
+  // Marks the end of a device report, normalizes the axis values of the
+  // report and delivers the changes.
+  void HandleReport(Device* device);
+  // Marks the current frame as a re-sync after events have been dropped.
+  void HandleResync(Device* device);
+  // Counts a raw event read from the device, for the metrics.
+  void HandleEventRead(Device* device) {
+    if (metrics_enabled_) {
+      device->metrics_.events_read += 1;
+    }
+  }
+  // Counts a failed read from the device, for the metrics.
+  void HandleReadError(Device* device);
+  // Mark a processing pass of ProcessEvents() or WaitForEvents(), after
+  // waiting for events. Clears the edges of the previous pass and measures
+  // the processing time for the metrics.
+  void BeginProcessing();
+  void EndProcessing();
+  // Returns the current time of the clock that event timestamps are taken
+  // from, in seconds. The default implementation uses steady_clock.
+  virtual double CurrentTime() const;
+  // Returns the mapping for the identity of a device, or nullptr.
+  const Mapping* FindMapping(uint16_t bus, uint16_t vendor, uint16_t product,
+      uint16_t version) const;
+  // Returns the timeout for WaitForEvents(), shortened so that delayed axis
+  // changes and settling filters are delivered in time.
+  int WaitTimeout(int timeout_ms) const;
+  // Returns true if messages of the level reach the log handler. Check this
+  // before composing expensive messages.
+  bool IsLogging(LogLevel level) const {
+    return log_handler_ && level <= log_level_;
+  }
+  void Log(LogLevel level, const std::string& message);
+
+  HandlerList<AttachedHandler> attached_handler_;
+  HandlerList<DetachedHandler> detached_handler_;
+  HandlerList<ButtonHandler> button_up_handler_;
+  HandlerList<ButtonHandler> button_down_handler_;
+  HandlerList<AxisHandler> axis_move_handler_;
+  HandlerList<FrameHandler> frame_handler_;
+  LogHandler log_handler_;
+  LogLevel log_level_ = LogLevel::kInfo;
+  Clock clock_ = Clock::kMonotonic;
+
+ private:
+  void HandleAxisBatch(Device* device);
+  // Adds the other axis of sticks with a radial dead zone to the report.
+  void AddStickAxes(Device* device);
+  // Delivers the changed axes of the batch.
+  void DispatchAxes(Device* device);
+  void EmitAxisMove(Device* device, int axis_id, float value,
+      float old_value, double timestamp);
+  // Delivers the frame of the device if it has changes, and clears it.
+  void DeliverFrame(Device* device);
+  // Remembers a changed axis or frame until the end of the pass.
+  void CoalesceAxis(Device* device, int axis_id, float old_value,
+      double timestamp);
+  void AddCoalescedDevice(Device* device);
+  // Delivers the coalesced changes that are due.
+  void FlushCoalesced();
+  // Reports the axes of the device whose smoothed values are settling.
+  void SettleAxes(Device* device, double timestamp);
+  void UpdateButtonBits(Device* device, int button_id, bool is_down);
+  void PublishSnapshot(Device* device);
+
+  // Records the time from the event timestamp to now.
+  void RecordLatency(Device* device, double timestamp);
+
+  // ID of the next handler added with one of the Add*() functions.
+  int next_handler_id_ = 1;
+
+  // Set while events are passed to a visitor instead of the handlers.
+  void* visitor_ = nullptr;
+  const VisitorCalls* visitor_calls_ = nullptr;
+
+  // Scratch memory for batch normalization of axis values.
+  std::vector<int> batch_values_;
+  std::vector<int> batch_flats_;
+  std::vector<float> batch_scales_;
+  std::vector<float> batch_offsets_;
+  std::vector<float> batch_results_;
+  std::vector<int> batch_axis_ids_;
+  std::vector<float> batch_eps_;
 
-  AttachedHandler attached_handler_;
-  DetachedHandler detached_handler_;
-  ButtonHandler button_up_handler_;
-  ButtonHandler button_down_handler_;
-  AxisHandler axis_move_handler_;
+  // Devices with pressed or released buttons in the current pass.
+  std::vector<Device*> edge_devices_;
+
+  // Set if axis changes are coalesced, and the devices with coalesced
+  // changes.
+  bool coalesce_ = false;
+  std::vector<Device*> coalesced_devices_;
+
+  MappingDatabase mapping_database_;
+
+  // Attached devices, for the metrics.
+  std::vector<Device*> attached_devices_;
+  bool metrics_enabled_ = false;
+  double processing_start_ = 0.0;
+  Histogram processing_time_;
+
+  // Published device states, and their copy in shared memory while
+  // publishing to other processes.
+  SnapshotTable snapshots_;
+  SharedSnapshotTable shared_snapshots_;
 };
 
+/* ---------------------------------------------------------------- */
+
+template <typename Visitor>
+void
+System::ProcessEvents(Visitor& visitor) {
+  visitor_ = &visitor;
+  visitor_calls_ = &VisitorThunks<Visitor>::kCalls;
+  ProcessEvents();
+  visitor_ = nullptr;
+  visitor_calls_ = nullptr;
+}
+
+template <typename Visitor>
+void
+System::WaitForEvents(int timeout_ms, Visitor& visitor) {
+  visitor_ = &visitor;
+  visitor_calls_ = &VisitorThunks<Visitor>::kCalls;
+  WaitForEvents(timeout_ms);
+  visitor_ = nullptr;
+  visitor_calls_ = nullptr;
+}
+
 }  // namespace pad
 
 #endif  // GAMEPAD_HEADER
@@ -0,0 +1,93 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_axis.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace gamepad {
+
+AxisTransform
+MakeAxisTransform(int minimum, int maximum, int fuzz, int flat) {
+  AxisTransform transform;
+  const float range =
+      static_cast<float>(maximum) - static_cast<float>(minimum);
+  if (range <= 0.0f) {
+    // Degenerate range. Report all values as zero.
+    return transform;
+  }
+  // Maps minimum to -1 and maximum to 1.
+  transform.scale = 2.0f / range;
+  transform.offset = -2.0f * static_cast<float>(minimum) / range - 1.0f;
+  transform.flat = flat;
+  transform.eps = static_cast<float>(2 * fuzz) / range;
+  return transform;
+}
+
+void
+NormalizeAxes(const int* values, const float* scales,
+    const float* offsets, const int* flats, float* results, std::size_t count) {
+  std::size_t i = 0;
+#if defined(__AVX2__)
+  const __m256 lower = _mm256_set1_ps(-1.0f);
+  const __m256 upper = _mm256_set1_ps(1.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m256i value = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(values + i));
+    const __m256i flat = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(flats + i));
+    // Zero values with -flat < value < flat.
+    const __m256i inside = _mm256_and_si256(
+        _mm256_cmpgt_epi32(value, _mm256_sub_epi32(_mm256_setzero_si256(), flat)),
+        _mm256_cmpgt_epi32(flat, value));
+    value = _mm256_andnot_si256(inside, value);
+    __m256 result = _mm256_cvtepi32_ps(value);
+    result = _mm256_add_ps(_mm256_mul_ps(result, _mm256_loadu_ps(scales + i)),
+        _mm256_loadu_ps(offsets + i));
+    result = _mm256_max_ps(lower, _mm256_min_ps(upper, result));
+    _mm256_storeu_ps(results + i, result);
+  }
+#elif defined(__SSE2__)
+  const __m128 lower = _mm_set1_ps(-1.0f);
+  const __m128 upper = _mm_set1_ps(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128i value = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(values + i));
+    const __m128i flat = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(flats + i));
+    // Zero values with -flat < value < flat.
+    const __m128i inside = _mm_and_si128(
+        _mm_cmpgt_epi32(value, _mm_sub_epi32(_mm_setzero_si128(), flat)),
+        _mm_cmplt_epi32(value, flat));
+    value = _mm_andnot_si128(inside, value);
+    __m128 result = _mm_cvtepi32_ps(value);
+    result = _mm_add_ps(_mm_mul_ps(result, _mm_loadu_ps(scales + i)),
+        _mm_loadu_ps(offsets + i));
+    result = _mm_max_ps(lower, _mm_min_ps(upper, result));
+    _mm_storeu_ps(results + i, result);
+  }
+#endif
+  // Remaining values, or all values without SIMD support.
+  NormalizeAxesScalar(values + i, scales + i, offsets + i, flats + i,
+      results + i, count - i);
+}
+
+void
+NormalizeAxesScalar(const int* values, const float* scales,
+    const float* offsets, const int* flats, float* results, std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    const int value = values[i] > -flats[i] && values[i] < flats[i]
+        ? 0 : values[i];
+    const float result = static_cast<float>(value) * scales[i] + offsets[i];
+    results[i] = std::max(-1.0f, std::min(1.0f, result));
+  }
+}
+
+}  // namespace gamepad
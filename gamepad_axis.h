@@ -0,0 +1,40 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_AXIS_HEADER
+#define GAMEPAD_AXIS_HEADER
+
+#include <cstddef>
+
+namespace gamepad {
+
+// Parameters to normalize raw axis values to [-1, 1], computed once per axis
+// when the device is attached.
+struct AxisTransform {
+  // Normalized value is raw value times scale plus offset.
+  float scale = 0.0f;
+  float offset = 0.0f;
+  // Raw values within (-flat, flat) are reported as zero.
+  int flat = 0;
+  // Normalized changes up to eps are not reported (derived from fuzz).
+  float eps = 0.0f;
+};
+
+// Computes the transform for an axis with the given raw range and the
+// fuzz and flat values reported by the device.
+AxisTransform MakeAxisTransform(int minimum, int maximum, int fuzz, int flat);
+
+// Normalizes a batch of raw axis values. The i-th value is flattened with
+// flats[i], normalized with scales[i] and offsets[i], and clamped to
+// [-1, 1]. Uses SSE2 or AVX2 if available at compile time.
+void NormalizeAxes(const int* values, const float* scales,
+    const float* offsets, const int* flats, float* results, std::size_t count);
+
+// Scalar implementation of NormalizeAxes(), also used for remaining values.
+void NormalizeAxesScalar(const int* values, const float* scales,
+    const float* offsets, const int* flats, float* results, std::size_t count);
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_AXIS_HEADER
@@ -0,0 +1,214 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_CORO_HEADER
+#define GAMEPAD_CORO_HEADER
+
+// Coroutines need C++20. Only this header does, gamepad.h remains C++11.
+#if !defined(__cpp_impl_coroutine)
+#error "gamepad_coro.h requires C++20 coroutines"
+#endif
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+
+#include "gamepad.h"
+
+namespace gamepad {
+
+// Awaitable button and axis events of a System, for coroutine-based
+// engines. A coroutine of the engine's task type awaits the next event:
+//
+//   EventStream stream(system.get());
+//   Task HandleInput(EventStream* stream) {
+//     while (true) {
+//       const Event event = co_await stream->NextEvent();
+//       ...
+//     }
+//   }
+//
+// The stream has no event loop or thread of its own. Register
+// PollDescriptor() with the event loop of the engine and call Dispatch()
+// when the descriptor becomes readable, and at the latest after
+// PollTimeout() milliseconds. Dispatch() processes the input without
+// blocking and resumes the waiting coroutines on the calling thread.
+// Without an event loop, Wait() blocks until input arrives and dispatches
+// it.
+//
+// Each event resumes one waiting coroutine, in the order in which they
+// started waiting. Events that arrive while no coroutine waits are queued.
+// A coroutine must not be destroyed while it waits. Attach and detach
+// events are passed to the handlers of the System as usual.
+//
+// When a device detaches, its events that no coroutine has taken yet are
+// dropped, even if they arrived in the same Dispatch(), so a queued event
+// never refers to a detached device. The device of a taken event is only
+// valid until the next Dispatch() or Wait(). To use the device later, keep
+// Device::handle and look the device up with System::GetDevice().
+class EventStream {
+ public:
+  class Awaiter;
+
+ public:
+  explicit EventStream(System* system);
+  EventStream(const EventStream&) = delete;
+  EventStream& operator=(const EventStream&) = delete;
+  ~EventStream();
+
+  // Returns an awaitable that resumes with the next event.
+  Awaiter NextEvent();
+
+  // The descriptor that becomes readable when input is pending, or -1 if
+  // the system does not provide one, see System::GetPollDescriptor().
+  int PollDescriptor() const { return system_->GetPollDescriptor(); }
+  // The time in milliseconds until Dispatch() must be called even without
+  // input, or -1, see System::GetPollTimeout().
+  int PollTimeout() const { return system_->GetPollTimeout(); }
+  // Processes pending input and resumes waiting coroutines. Does not block.
+  void Dispatch();
+  // Blocks until input arrives or the timeout (in milliseconds) expires,
+  // then dispatches like Dispatch(). A negative timeout blocks until input
+  // arrives.
+  void Wait(int timeout_ms);
+
+  // Returns the number of events that no coroutine has awaited yet.
+  std::size_t NumQueued() const { return events_.size(); }
+
+ private:
+  // Queues the events of a processing call, see System::ProcessEvents().
+  struct Collector {
+    EventStream* stream;
+
+    void OnButtonDown(Device* device, int button_id, double timestamp);
+    void OnButtonUp(Device* device, int button_id, double timestamp);
+    void OnAxisMove(Device* device, int axis_id, float value,
+        float old_value, double timestamp);
+  };
+
+  // Resumes waiting coroutines while events are queued.
+  void Resume();
+  // Removes the queued events of a detached device.
+  void DropEvents(Device* device);
+
+ private:
+  System* system_;
+  int detach_handler_id_ = 0;
+  std::deque<Event> events_;
+  std::deque<std::coroutine_handle<>> waiters_;
+};
+
+// The awaitable of EventStream::NextEvent(). Completes immediately if an
+// event is queued and no other coroutine waits for it.
+class EventStream::Awaiter {
+ public:
+  explicit Awaiter(EventStream* stream) : stream_(stream) {}
+
+  bool await_ready() const noexcept {
+    return !stream_->events_.empty() && stream_->waiters_.empty();
+  }
+  void await_suspend(std::coroutine_handle<> handle) {
+    stream_->waiters_.push_back(handle);
+  }
+  Event await_resume() {
+    const Event event = stream_->events_.front();
+    stream_->events_.pop_front();
+    return event;
+  }
+
+ private:
+  EventStream* stream_;
+};
+
+/* ---------------------------------------------------------------- */
+
+inline
+EventStream::EventStream(System* system)
+    : system_(system) {
+  detach_handler_id_ = system_->AddDetachHandler([this](Device* device) {
+    DropEvents(device);
+  });
+}
+
+inline
+EventStream::~EventStream() {
+  system_->RemoveHandler(detach_handler_id_);
+}
+
+inline EventStream::Awaiter
+EventStream::NextEvent() {
+  return Awaiter(this);
+}
+
+inline void
+EventStream::Dispatch() {
+  Collector collector{ this };
+  system_->ProcessEvents(collector);
+  Resume();
+}
+
+inline void
+EventStream::Wait(int timeout_ms) {
+  Collector collector{ this };
+  system_->WaitForEvents(timeout_ms, collector);
+  Resume();
+}
+
+inline void
+EventStream::Resume() {
+  // A resumed coroutine takes its event before it returns here, and waits
+  // again behind the other waiting coroutines.
+  while (!waiters_.empty() && !events_.empty()) {
+    const std::coroutine_handle<> handle = waiters_.front();
+    waiters_.pop_front();
+    handle.resume();
+  }
+}
+
+inline void
+EventStream::DropEvents(Device* device) {
+  events_.erase(std::remove_if(events_.begin(), events_.end(),
+      [device](const Event& event) { return event.device == device; }),
+      events_.end());
+}
+
+inline void
+EventStream::Collector::OnButtonDown(Device* device, int button_id,
+    double timestamp) {
+  Event event;
+  event.type = Event::kButtonDown;
+  event.device = device;
+  event.id = button_id;
+  event.timestamp = timestamp;
+  stream->events_.push_back(event);
+}
+
+inline void
+EventStream::Collector::OnButtonUp(Device* device, int button_id,
+    double timestamp) {
+  Event event;
+  event.type = Event::kButtonUp;
+  event.device = device;
+  event.id = button_id;
+  event.timestamp = timestamp;
+  stream->events_.push_back(event);
+}
+
+inline void
+EventStream::Collector::OnAxisMove(Device* device, int axis_id, float value,
+    float old_value, double timestamp) {
+  Event event;
+  event.type = Event::kAxisMove;
+  event.device = device;
+  event.id = axis_id;
+  event.value = value;
+  event.old_value = old_value;
+  event.timestamp = timestamp;
+  stream->events_.push_back(event);
+}
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_CORO_HEADER
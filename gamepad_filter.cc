@@ -0,0 +1,209 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gamepad {
+namespace {
+
+// Updates closer than this are treated as one millisecond apart, which
+// keeps the 1€ filter stable for events with equal timestamps.
+constexpr double kMinInterval = 1e-3;
+// Smoothed values within this distance of the input snap to the input.
+constexpr float kSettleDistance = 1e-3f;
+
+// Returns the weight of the new value of a low-pass filter with the cutoff
+// frequency in Hz for the time step in seconds.
+float LowPassAlpha(float cutoff, float interval) {
+  const float tau = 1.0f / (2.0f * 3.14159265f * cutoff);
+  return 1.0f / (1.0f + tau / interval);
+}
+
+}  // namespace
+
+void
+AxisFilterBank::SetAxisFilter(int axis_id, const AxisFilter& filter) {
+  if (axis_id < 0) {
+    return;
+  }
+  Resize(axis_id);
+  curves_[axis_id] = filter.curve;
+  min_cutoffs_[axis_id] = filter.min_cutoff;
+  betas_[axis_id] = filter.beta;
+  derivative_cutoffs_[axis_id] = filter.derivative_cutoff;
+  smoothings_[axis_id] = std::max(1e-3f, std::min(1.0f, filter.smoothing));
+  // Restart the filter with the next value.
+  times_[axis_id] = -1.0;
+  if (settling_[axis_id]) {
+    settling_[axis_id] = 0;
+    num_settling_ -= 1;
+  }
+}
+
+void
+AxisFilterBank::SetStickDeadZone(int x_axis, int y_axis, float inner,
+    float outer) {
+  if (x_axis < 0 || y_axis < 0 || x_axis == y_axis) {
+    return;
+  }
+  Resize(std::max(x_axis, y_axis));
+  // An axis belongs to at most one stick.
+  for (auto iter = sticks_.begin(); iter != sticks_.end();) {
+    if (iter->x_axis == x_axis || iter->y_axis == x_axis ||
+        iter->x_axis == y_axis || iter->y_axis == y_axis) {
+      partners_[iter->x_axis] = -1;
+      partners_[iter->y_axis] = -1;
+      iter = sticks_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  sticks_.push_back(Stick{ x_axis, y_axis, inner, outer });
+  partners_[x_axis] = y_axis;
+  partners_[y_axis] = x_axis;
+}
+
+void
+AxisFilterBank::Clear() {
+  *this = AxisFilterBank();
+}
+
+int
+AxisFilterBank::StickPartner(int axis_id) const {
+  if (axis_id < 0 || axis_id >= static_cast<int>(partners_.size())) {
+    return -1;
+  }
+  return partners_[axis_id];
+}
+
+void
+AxisFilterBank::Apply(const int* axis_ids, float* values, std::size_t count,
+    double timestamp) {
+  for (const Stick& stick : sticks_) {
+    ApplyDeadZone(stick, axis_ids, values, count);
+  }
+  const int num_axes = static_cast<int>(curves_.size());
+  for (std::size_t i = 0; i < count; ++i) {
+    const int axis_id = axis_ids[i];
+    if (axis_id < 0 || axis_id >= num_axes) {
+      continue;
+    }
+    float value = values[i];
+    if (curves_[axis_id] != 1.0f) {
+      value = std::copysign(std::pow(std::fabs(value), curves_[axis_id]),
+          value);
+    }
+    values[i] = Smooth(axis_id, value, timestamp);
+  }
+}
+
+void
+AxisFilterBank::Settle(double timestamp, std::vector<int>* axis_ids,
+    std::vector<float>* values) {
+  const int num_axes = static_cast<int>(settling_.size());
+  for (int axis_id = 0; axis_id < num_axes && num_settling_ > 0; ++axis_id) {
+    if (settling_[axis_id]) {
+      axis_ids->push_back(axis_id);
+      values->push_back(Smooth(axis_id, inputs_[axis_id], timestamp));
+    }
+  }
+}
+
+void
+AxisFilterBank::Resize(int axis_id) {
+  const std::size_t size = axis_id + 1;
+  if (curves_.size() >= size) {
+    return;
+  }
+  partners_.resize(size, -1);
+  curves_.resize(size, 1.0f);
+  min_cutoffs_.resize(size, 0.0f);
+  betas_.resize(size, 0.0f);
+  derivative_cutoffs_.resize(size, 1.0f);
+  smoothings_.resize(size, 1.0f);
+  inputs_.resize(size, 0.0f);
+  euro_outputs_.resize(size, 0.0f);
+  outputs_.resize(size, 0.0f);
+  speeds_.resize(size, 0.0f);
+  times_.resize(size, -1.0);
+  settling_.resize(size, 0);
+}
+
+void
+AxisFilterBank::ApplyDeadZone(const Stick& stick, const int* axis_ids,
+    float* values, std::size_t count) const {
+  int x_index = -1;
+  int y_index = -1;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (axis_ids[i] == stick.x_axis) {
+      x_index = i;
+    } else if (axis_ids[i] == stick.y_axis) {
+      y_index = i;
+    }
+  }
+  if (x_index < 0 || y_index < 0) {
+    return;
+  }
+
+  // Rescale the magnitude from [inner, outer] to [0, 1].
+  const float x = values[x_index];
+  const float y = values[y_index];
+  const float magnitude = std::sqrt(x * x + y * y);
+  float scale = 0.0f;
+  if (magnitude > stick.inner) {
+    const float range = stick.outer - stick.inner;
+    const float rescaled = range > 0.0f
+        ? std::min(1.0f, (magnitude - stick.inner) / range) : 1.0f;
+    scale = rescaled / magnitude;
+  }
+  values[x_index] = x * scale;
+  values[y_index] = y * scale;
+}
+
+float
+AxisFilterBank::Smooth(int axis_id, float input, double timestamp) {
+  if (times_[axis_id] < 0.0) {
+    inputs_[axis_id] = input;
+    euro_outputs_[axis_id] = input;
+    outputs_[axis_id] = input;
+    speeds_[axis_id] = 0.0f;
+    times_[axis_id] = timestamp;
+    return input;
+  }
+  const float interval = static_cast<float>(
+      std::max(timestamp - times_[axis_id], kMinInterval));
+  times_[axis_id] = timestamp;
+
+  float value = input;
+  if (min_cutoffs_[axis_id] > 0.0f) {
+    const float speed = (input - inputs_[axis_id]) / interval;
+    speeds_[axis_id] += LowPassAlpha(derivative_cutoffs_[axis_id], interval) *
+        (speed - speeds_[axis_id]);
+    const float cutoff = min_cutoffs_[axis_id] +
+        betas_[axis_id] * std::fabs(speeds_[axis_id]);
+    euro_outputs_[axis_id] += LowPassAlpha(cutoff, interval) *
+        (input - euro_outputs_[axis_id]);
+    value = euro_outputs_[axis_id];
+  }
+  inputs_[axis_id] = input;
+  outputs_[axis_id] += smoothings_[axis_id] * (value - outputs_[axis_id]);
+
+  // Snap to the input once close enough, which ends settling.
+  const bool settling = std::fabs(outputs_[axis_id] - input) >=
+      kSettleDistance;
+  if (!settling) {
+    euro_outputs_[axis_id] = input;
+    outputs_[axis_id] = input;
+  }
+  if (settling != static_cast<bool>(settling_[axis_id])) {
+    settling_[axis_id] = settling;
+    num_settling_ += settling ? 1 : -1;
+  }
+  return outputs_[axis_id];
+}
+
+}  // namespace gamepad
@@ -0,0 +1,102 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_FILTER_HEADER
+#define GAMEPAD_FILTER_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gamepad {
+
+// Filter settings of a normalized axis value. The defaults pass the value
+// through unchanged.
+struct AxisFilter {
+  // Exponent of the response curve, applied to the magnitude of the value.
+  // Exponents above one give finer control near the center.
+  float curve = 1.0f;
+  // The 1€ filter (Casiez et al., CHI 2012) smooths slow movements with the
+  // minimum cutoff frequency in Hz, and raises the cutoff frequency with the
+  // speed times beta to reduce lag on fast movements. A minimum cutoff of
+  // zero disables the filter.
+  float min_cutoff = 0.0f;
+  float beta = 0.0f;
+  // Cutoff frequency in Hz for the speed estimate of the 1€ filter.
+  float derivative_cutoff = 1.0f;
+  // Weight of the new value for exponential smoothing per report, in
+  // (0, 1]. A weight of one disables smoothing.
+  float smoothing = 1.0f;
+};
+
+// The filters of the axes of a device. The filters are applied to the
+// normalized values of a report in the order radial dead zone, response
+// curve, 1€ filter and exponential smoothing. Parameters and state are kept
+// in flat arrays indexed by axis ID, so applying the filters does not
+// allocate.
+class AxisFilterBank {
+ public:
+  void SetAxisFilter(int axis_id, const AxisFilter& filter);
+  // Sets a radial dead zone for the stick formed by the two axes. Stick
+  // magnitudes below inner are reported as zero, magnitudes above outer as
+  // one, and magnitudes in between are rescaled. The direction is kept.
+  void SetStickDeadZone(int x_axis, int y_axis, float inner, float outer);
+  void Clear();
+  bool Empty() const { return curves_.empty(); }
+
+  // Returns the other axis of the stick with a radial dead zone, or -1.
+  int StickPartner(int axis_id) const;
+
+  // Filters the normalized values of a report in place. Both axes of a
+  // stick with a dead zone must be part of the report.
+  void Apply(const int* axis_ids, float* values, std::size_t count,
+      double timestamp);
+
+  // Returns true if smoothed values have not reached their input yet.
+  bool Settling() const { return num_settling_ > 0; }
+  // Advances the smoothing of the settling axes as if their last input was
+  // reported again, and appends the axes and their new values.
+  void Settle(double timestamp, std::vector<int>* axis_ids,
+      std::vector<float>* values);
+
+ private:
+  struct Stick {
+    int x_axis;
+    int y_axis;
+    float inner;
+    float outer;
+  };
+
+  void Resize(int axis_id);
+  void ApplyDeadZone(const Stick& stick, const int* axis_ids, float* values,
+      std::size_t count) const;
+  float Smooth(int axis_id, float input, double timestamp);
+
+ private:
+  std::vector<Stick> sticks_;
+  // The stick partner per axis, or -1.
+  std::vector<int> partners_;
+
+  // Filter parameters per axis.
+  std::vector<float> curves_;
+  std::vector<float> min_cutoffs_;
+  std::vector<float> betas_;
+  std::vector<float> derivative_cutoffs_;
+  std::vector<float> smoothings_;
+
+  // Filter state per axis: the last input after the response curve, the
+  // outputs of the 1€ filter and of the smoothing, the speed estimate, and
+  // the time of the last update (negative before the first update).
+  std::vector<float> inputs_;
+  std::vector<float> euro_outputs_;
+  std::vector<float> outputs_;
+  std::vector<float> speeds_;
+  std::vector<double> times_;
+  std::vector<uint8_t> settling_;
+  int num_settling_ = 0;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_FILTER_HEADER
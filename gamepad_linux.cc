@@ -10,73 +10,770 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <libevdev/libevdev.h>
+
 #include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <utility>
+
+// Older kernel headers lack the accessors for the event time.
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
 
 namespace gamepad {
 namespace {
-void EvdevPrintEventBits(struct libevdev* dev, unsigned int type, unsigned int max) {
-	for (unsigned int i = 0; i <= max; i++) {
-		if (!libevdev_has_event_code(dev, type, i))
-			continue;
-		printf("    Event code %i - %s", i, libevdev_event_code_get_name(type, i));
-		if (type == EV_ABS) {
-      const struct input_absinfo* abs = libevdev_get_abs_info(dev, i);
-      printf(" (value=%d min=%d max=%d fuzz=%d flat=%d res=%d)\n",
-          abs->value, abs->minimum, abs->maximum,
-          abs->fuzz, abs->flat, abs->resolution);
+// Maximum number of ready descriptors fetched per epoll_wait() call. Further
+// ready descriptors are reported by the next call.
+constexpr int kMaxEpollEvents = 64;
+// Device files with the joystick suffix in this directory are attached.
+constexpr const char* kDevicesDirectory = "/dev/input/by-id/";
+constexpr const char* kParentDirectory = "/dev/input/";
+constexpr const char* kDeviceSuffix = "-event-joystick";
+
+// Epoll user data of the inotify and input thread descriptors. Device data
+// is always larger since slot generations start at one.
+constexpr uint64_t kInotifyEpollData = 0;
+constexpr uint64_t kThreadWakeEpollData = 1;
+constexpr uint64_t kThreadStopEpollData = 2;
+// Capacity of the input thread event queue.
+constexpr std::size_t kEventQueueCapacity = 4096;
+// Event type of a queued read error.
+constexpr uint16_t kEvdevErrorType = 0xffff;
+// Event type that replaces the SYN_REPORT which ends dropped events. The
+// device state is queried when it is read, see EvdevQueryState().
+constexpr uint16_t kEvdevResyncType = 0xfffe;
+// Event type of a button state queried after dropped events. Unlike EV_KEY,
+// it is only processed if the state of the button differs.
+constexpr uint16_t kEvdevResyncKeyType = 0xfffd;
+
+// Returns the epoll user data for a device.
+uint64_t EvdevEpollData(DeviceHandle handle) {
+  return static_cast<uint64_t>(handle.generation) << 32 | handle.index;
+}
+
+// Returns the device handle for epoll user data.
+DeviceHandle EvdevEpollHandle(uint64_t data) {
+  DeviceHandle handle;
+  handle.index = static_cast<uint32_t>(data);
+  handle.generation = static_cast<uint32_t>(data >> 32);
+  return handle;
+}
+
+// Returns the clock ID for EVIOCSCLOCKID.
+int EvdevClockId(System::Clock clock) {
+  return clock == System::Clock::kRealtime ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+}
+
+// Selects the clock of the event timestamps of a device.
+void EvdevSetClock(int file_descriptor, System::Clock clock) {
+  int clock_id = EvdevClockId(clock);
+  if (::ioctl(file_descriptor, EVIOCSCLOCKID, &clock_id) < 0) {
+    fprintf(stderr, "Failed to set clock: %s\n", ::strerror(errno));
+  }
+}
+
+// Returns the kernel timestamp of the event in seconds.
+double EvdevTimestamp(const struct input_event& event) {
+  return static_cast<double>(event.input_event_sec) +
+      static_cast<double>(event.input_event_usec) * 1e-6;
+}
+
+// Reads pending events into the read buffer of the device with a single
+// read() call. After a SYN_DROPPED, the kernel delivers incomplete events
+// up to the next SYN_REPORT. These are removed in place, and the SYN_REPORT
+// is replaced by a resync event. Returns the number of events read, zero if
+// no events are pending, or -1 on error. The number of events left in the
+// buffer is returned in count.
+ssize_t EvdevReadBatch(EvdevDevice* device, std::size_t* count) {
+  *count = 0;
+  ssize_t length = 0;
+  do {
+    length = ::read(device->file_descriptor, device->read_buffer,
+        sizeof(device->read_buffer));
+  } while (length < 0 && errno == EINTR);
+  if (length < 0) {
+    return errno == EAGAIN ? 0 : -1;
+  }
+
+  const std::size_t num_events = length / sizeof(struct input_event);
+  std::size_t num_kept = 0;
+  for (std::size_t i = 0; i < num_events; ++i) {
+    struct input_event event = device->read_buffer[i];
+    if (event.type == EV_SYN && event.code == SYN_DROPPED) {
+      device->dropped = true;
+    } else if (device->dropped) {
+      if (event.type != EV_SYN || event.code != SYN_REPORT) {
+        continue;
+      }
+      device->dropped = false;
+      event.type = kEvdevResyncType;
+    }
+    device->read_buffer[num_kept++] = event;
+  }
+  *count = num_kept;
+  return static_cast<ssize_t>(num_events);
+}
+
+// Queries the button and axis states of the device after dropped events and
+// appends them as events, terminated by a report. Only reads the device file
+// and its layout, so that the input thread can query the state while the
+// main thread owns the button and axis states.
+void EvdevQueryState(const EvdevDevice& device, double timestamp,
+    std::vector<EvdevEvent>* events) {
+  EvdevEvent event;
+  event.handle = device.device.handle;
+  event.timestamp = timestamp;
+  uint8_t keys[KEY_MAX / 8 + 1] = {};
+  if (::ioctl(device.file_descriptor, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+    for (const unsigned int code : device.layout.button_codes) {
+      if (code == KEY_RESERVED) {
+        continue;
+      }
+      event.type = kEvdevResyncKeyType;
+      event.code = code;
+      event.value = (keys[code / 8] >> (code % 8)) & 1;
+      events->push_back(event);
+    }
+  }
+  const auto query_axis = [&device, &event, events](unsigned int code) {
+    struct input_absinfo abs;
+    if (code < ABS_CNT &&
+        ::ioctl(device.file_descriptor, EVIOCGABS(code), &abs) >= 0) {
+      event.type = EV_ABS;
+      event.code = code;
+      event.value = abs.value;
+      events->push_back(event);
+    }
+  };
+  for (const EvdevAxisInfo& axis_info : device.layout.axis_infos) {
+    query_axis(axis_info.code);
+  }
+  for (const EvdevAxisButtons& entry : device.layout.axis_buttons) {
+    query_axis(entry.code);
+  }
+  event.type = EV_SYN;
+  event.code = SYN_REPORT;
+  event.value = 0;
+  events->push_back(event);
+}
+
+// Capability bitmaps as returned by EVIOCGBIT.
+constexpr std::size_t kBitsPerLong = sizeof(unsigned long) * 8;
+
+// Returns the number of longs of a bitmap for the codes 0 to max.
+constexpr std::size_t EvdevBitmapSize(unsigned int max) {
+  return max / kBitsPerLong + 1;
+}
+
+// Fetches the bitmap of the supported codes of the event type, or of the
+// supported event types for type zero. Returns false on error.
+bool EvdevGetBits(int file_descriptor, unsigned int type,
+    unsigned long* bits, std::size_t size) {
+  std::fill(bits, bits + size, 0ul);
+  return ::ioctl(file_descriptor, EVIOCGBIT(type, size * sizeof(*bits)),
+      bits) >= 0;
+}
+
+// Returns the number of set bits of the bitmap.
+std::size_t EvdevCountBits(const unsigned long* bits, std::size_t size) {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    count += __builtin_popcountl(bits[i]);
+  }
+  return count;
+}
+
+// Calls the function for every set bit of the bitmap in increasing order.
+// Only set bits are visited, which skips the mostly empty words quickly.
+template <typename Function>
+void EvdevForEachBit(const unsigned long* bits, std::size_t size,
+    Function function) {
+  for (std::size_t i = 0; i < size; ++i) {
+    for (unsigned long word = bits[i]; word != 0; word &= word - 1) {
+      function(static_cast<unsigned int>(i * kBitsPerLong +
+          __builtin_ctzl(word)));
+    }
+  }
+}
+
+// Returns a hash of the capability bitmaps (FNV-1a).
+uint64_t EvdevHashBits(const unsigned long* key_bits,
+    const unsigned long* abs_bits) {
+  uint64_t hash = 14695981039346656037ull;
+  const auto add = [&hash](const unsigned long* bits, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bits[i]) * 1099511628211ull;
+    }
+  };
+  add(key_bits, EvdevBitmapSize(KEY_MAX));
+  add(abs_bits, EvdevBitmapSize(ABS_MAX));
+  return hash;
+}
+
+// Derives the buttons and axes from the capability bitmaps. Button and axis
+// IDs are assigned in code order.
+void EvdevProbeLayout(int file_descriptor, const unsigned long* key_bits,
+    const unsigned long* abs_bits, EvdevLayout* layout) {
+  layout->button_codes.reserve(
+      EvdevCountBits(key_bits, EvdevBitmapSize(KEY_MAX)));
+  EvdevForEachBit(key_bits, EvdevBitmapSize(KEY_MAX),
+      [layout](unsigned int code) {
+    layout->key_map.Add(code, static_cast<int>(layout->button_codes.size()));
+    layout->button_codes.push_back(static_cast<uint16_t>(code));
+  });
+
+  EvdevForEachBit(abs_bits, EvdevBitmapSize(ABS_MAX),
+      [layout, file_descriptor](unsigned int code) {
+    struct input_absinfo abs;
+    if (::ioctl(file_descriptor, EVIOCGABS(code), &abs) < 0) {
+      return;
+    }
+    EvdevAxisInfo axis_info;
+    axis_info.code = code;
+    axis_info.minimum = abs.minimum;
+    axis_info.maximum = abs.maximum;
+    axis_info.flat = abs.flat;
+    axis_info.fuzz = abs.fuzz;
+    axis_info.transform = MakeAxisTransform(abs.minimum, abs.maximum,
+        abs.fuzz, abs.flat);
+    layout->axis_map.axis_id[code] =
+        static_cast<int8_t>(layout->axis_infos.size());
+    layout->axis_infos.push_back(axis_info);
+  });
+}
+
+// Returns the transform of an axis in the standard layout. Triggers are
+// normalized to [0, 1] instead of [-1, 1].
+AxisTransform EvdevStandardTransform(const EvdevAxisInfo& axis_info,
+    bool is_trigger, bool inverted) {
+  AxisTransform transform = MakeAxisTransform(axis_info.minimum,
+      axis_info.maximum, axis_info.fuzz, axis_info.flat);
+  if (inverted) {
+    transform.scale = -transform.scale;
+    transform.offset = -transform.offset;
+  }
+  if (is_trigger) {
+    transform.scale *= 0.5f;
+    transform.offset = transform.offset * 0.5f + 0.5f;
+    transform.eps *= 0.5f;
+  }
+  return transform;
+}
+
+// Lets the axis drive the button on the negative or positive side.
+void EvdevAddAxisButton(const EvdevAxisInfo& axis_info, bool positive,
+    int button_id, EvdevLayout* layout) {
+  const int8_t axis_id = layout->axis_map.axis_id[axis_info.code];
+  if (axis_id >= 0) {
+    return;
+  }
+  auto iter = std::find_if(layout->axis_buttons.begin(),
+      layout->axis_buttons.end(), [&axis_info](const EvdevAxisButtons& entry) {
+        return entry.code == axis_info.code;
+      });
+  if (iter == layout->axis_buttons.end()) {
+    // The buttons switch at a quarter of the range from the center, hats
+    // with values -1, 0 and 1 at any value other than zero.
+    EvdevAxisButtons entry;
+    entry.code = axis_info.code;
+    const int center = axis_info.minimum +
+        (axis_info.maximum - axis_info.minimum) / 2;
+    const int quarter = (axis_info.maximum - axis_info.minimum) / 4;
+    entry.negative_below = center - quarter;
+    entry.positive_above = center + quarter;
+    layout->axis_buttons.push_back(entry);
+    layout->axis_map.axis_id[axis_info.code] = EvdevAxisMap::kButtons;
+    iter = layout->axis_buttons.end() - 1;
+  }
+  (positive ? iter->positive_button : iter->negative_button) = button_id;
+}
+
+// Builds the layout of a device in the standard layout from its probed
+// layout. Mapping sources index the buttons, axes and hats in the order of
+// SDL, see MappingDatabase.
+void EvdevMapLayout(const Mapping& mapping, const EvdevLayout& raw,
+    EvdevLayout* layout) {
+  std::vector<uint16_t> buttons;
+  for (uint16_t code : raw.button_codes) {
+    if (code >= BTN_JOYSTICK) {
+      buttons.push_back(code);
+    }
+  }
+  for (uint16_t code : raw.button_codes) {
+    if (code < BTN_JOYSTICK) {
+      buttons.push_back(code);
+    }
+  }
+  // Hats are listed by their X axis. The Y axis directly follows it.
+  std::vector<const EvdevAxisInfo*> axes;
+  std::vector<unsigned int> hats;
+  for (const EvdevAxisInfo& axis_info : raw.axis_infos) {
+    if (axis_info.code < ABS_HAT0X || axis_info.code > ABS_HAT3Y) {
+      axes.push_back(&axis_info);
     } else {
-      printf("\n");
+      const unsigned int hat_code = axis_info.code & ~1u;
+      if (hats.empty() || hats.back() != hat_code) {
+        hats.push_back(hat_code);
+      }
     }
-	}
+  }
+  const auto find_axis = [&raw](unsigned int code) -> const EvdevAxisInfo* {
+    const int axis_id = raw.axis_map.axis_id[code];
+    return axis_id >= 0 ? &raw.axis_infos[axis_id] : nullptr;
+  };
+
+  *layout = EvdevLayout();
+  layout->axis_infos.resize(StandardLayout::kNumAxes);
+  for (int axis_id = 0; axis_id < StandardLayout::kNumAxes; ++axis_id) {
+    EvdevAxisInfo& axis_info = layout->axis_infos[axis_id];
+    axis_info.code = ABS_CNT;
+    const MappingSource& source = mapping.axes[axis_id];
+    if (source.type != MappingSource::kAxis || source.index >= axes.size() ||
+        layout->axis_map.axis_id[axes[source.index]->code] >= 0) {
+      continue;
+    }
+    axis_info = *axes[source.index];
+    axis_info.transform = EvdevStandardTransform(axis_info,
+        axis_id >= StandardLayout::kLeftTrigger, source.inverted);
+    layout->axis_map.axis_id[axis_info.code] = static_cast<int8_t>(axis_id);
+  }
+
+  std::vector<std::pair<uint16_t, int>> keys;
+  layout->button_codes.assign(StandardLayout::kNumButtons, KEY_RESERVED);
+  for (int button_id = 0; button_id < StandardLayout::kNumButtons;
+      ++button_id) {
+    const MappingSource& source = mapping.buttons[button_id];
+    if (source.type == MappingSource::kButton &&
+        source.index < buttons.size()) {
+      keys.emplace_back(buttons[source.index], button_id);
+    } else if (source.type == MappingSource::kAxis &&
+        source.index < axes.size()) {
+      EvdevAddAxisButton(*axes[source.index],
+          (source.half < 0) == source.inverted, button_id, layout);
+    } else if (source.type == MappingSource::kHat &&
+        source.index < hats.size()) {
+      // Hat directions: 1 is up, 2 right, 4 down and 8 left.
+      const bool vertical = (source.hat_mask & 5) != 0;
+      const EvdevAxisInfo* axis_info =
+          find_axis(hats[source.index] + (vertical ? 1 : 0));
+      if (axis_info != nullptr) {
+        EvdevAddAxisButton(*axis_info, (source.hat_mask & 6) != 0,
+            button_id, layout);
+      }
+    }
+  }
+  // Codes are added to the key map in increasing order. A code that is
+  // mapped to several buttons drives the first of them.
+  std::sort(keys.begin(), keys.end());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    if (i > 0 && keys[i].first == keys[i - 1].first) {
+      continue;
+    }
+    layout->key_map.Add(keys[i].first, keys[i].second);
+    layout->button_codes[keys[i].second] = keys[i].first;
+  }
+}
+
+// Returns the name of an event type or code, or "?" if it is unknown.
+const char* EvdevName(const char* name) {
+  return name != nullptr ? name : "?";
 }
 
-void EvdevPrintEvents(struct libevdev* evdev) {
-	printf("Attached: %s\n", libevdev_get_name(evdev));
-	for (unsigned int i = 0; i <= EV_MAX; i++) {
-		if (libevdev_has_event_type(evdev, i)) {
-			printf("  Event type %d - %s\n", i, libevdev_event_type_get_name(i));
+// Describes the event types and the key, relative axis, absolute axis and
+// LED codes of the device, one per line without a trailing newline.
+std::string EvdevDescribeCapabilities(int file_descriptor) {
+  std::ostringstream out;
+  unsigned long type_bits[EvdevBitmapSize(EV_MAX)];
+  EvdevGetBits(file_descriptor, 0, type_bits, EvdevBitmapSize(EV_MAX));
+  EvdevForEachBit(type_bits, EvdevBitmapSize(EV_MAX),
+      [&out, file_descriptor](unsigned int type) {
+    out << "  Event type " << type << " - "
+        << EvdevName(libevdev_event_type_get_name(type)) << "\n";
+    unsigned int max = 0;
+    switch (type) {
+      case EV_KEY: max = KEY_MAX; break;
+      case EV_REL: max = REL_MAX; break;
+      case EV_ABS: max = ABS_MAX; break;
+      case EV_LED: max = LED_MAX; break;
+      case EV_FF: max = FF_MAX; break;
+      default: return;
     }
-		switch(i) {
-			case EV_KEY:
-				EvdevPrintEventBits(evdev, EV_KEY, KEY_MAX);
-				break;
-			case EV_REL:
-				EvdevPrintEventBits(evdev, EV_REL, REL_MAX);
-				break;
-			case EV_ABS:
-				EvdevPrintEventBits(evdev, EV_ABS, ABS_MAX);
-				break;
-			case EV_LED:
-				EvdevPrintEventBits(evdev, EV_LED, LED_MAX);
-				break;
-		}
+    unsigned long code_bits[EvdevBitmapSize(KEY_MAX)];
+    EvdevGetBits(file_descriptor, type, code_bits, EvdevBitmapSize(max));
+    EvdevForEachBit(code_bits, EvdevBitmapSize(max),
+        [&out, file_descriptor, type](unsigned int code) {
+      out << "    Event code " << code << " - "
+          << EvdevName(libevdev_event_code_get_name(type, code));
+      struct input_absinfo abs;
+      if (type == EV_ABS &&
+          ::ioctl(file_descriptor, EVIOCGABS(code), &abs) >= 0) {
+        out << " (value=" << abs.value << " min=" << abs.minimum
+            << " max=" << abs.maximum << " fuzz=" << abs.fuzz
+            << " flat=" << abs.flat << " res=" << abs.resolution << ")";
+      }
+      out << "\n";
+    });
+  });
+  std::string description = out.str();
+  if (!description.empty()) {
+    description.pop_back();
   }
+  return description;
 }
 }  // namespace
 
+constexpr std::size_t EvdevDevice::kReadBufferSize;
+
+bool
+EvdevRumble::Play(int file_descriptor, uint16_t strong, uint16_t weak,
+    uint16_t length_ms) {
+  if ((strong == 0 && weak == 0) || length_ms == 0) {
+    // Stopping an effect that is not playing costs nothing.
+    if (!playing_) {
+      return true;
+    }
+    playing_ = false;
+    return Write(file_descriptor, 0);
+  }
+  if (effect_id_ < 0 || strong != strong_ || weak != weak_ ||
+      length_ms != length_ms_) {
+    if (!Upload(file_descriptor, strong, weak, length_ms)) {
+      return false;
+    }
+  }
+  // Playing again restarts the effect with its full length.
+  playing_ = Write(file_descriptor, 1);
+  return playing_;
+}
+
+bool
+EvdevRumble::Upload(int file_descriptor, uint16_t strong, uint16_t weak,
+    uint16_t length_ms) {
+  // Uploading with the ID of the uploaded effect updates it in place, also
+  // while it is playing.
+  struct ff_effect effect;
+  std::memset(&effect, 0, sizeof(effect));
+  effect.type = FF_RUMBLE;
+  effect.id = static_cast<int16_t>(effect_id_);
+  effect.u.rumble.strong_magnitude = strong;
+  effect.u.rumble.weak_magnitude = weak;
+  effect.replay.length = length_ms;
+  if (::ioctl(file_descriptor, EVIOCSFF, &effect) < 0) {
+    return false;
+  }
+  effect_id_ = effect.id;
+  strong_ = strong;
+  weak_ = weak;
+  length_ms_ = length_ms;
+  return true;
+}
+
+bool
+EvdevRumble::Write(int file_descriptor, int value) {
+  struct input_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.type = EV_FF;
+  event.code = static_cast<uint16_t>(effect_id_);
+  event.value = value;
+  return ::write(file_descriptor, &event, sizeof(event)) ==
+      static_cast<ssize_t>(sizeof(event));
+}
+
+constexpr int8_t EvdevAxisMap::kButtons;
+
+EvdevKeyMap::EvdevKeyMap() {
+  std::fill(dense_, dense_ + sizeof(dense_), -1);
+}
+
+void
+EvdevKeyMap::Add(unsigned int code, int button_id) {
+  // The dense table stores IDs as bytes. Larger IDs go to the sorted list.
+  if (code >= kDenseBegin && code < kDenseEnd && button_id <= INT8_MAX) {
+    dense_[code - kDenseBegin] = static_cast<int8_t>(button_id);
+  } else {
+    Entry entry;
+    entry.code = static_cast<uint16_t>(code);
+    entry.button_id = static_cast<int16_t>(button_id);
+    sparse_.push_back(entry);
+  }
+}
+
+int
+EvdevKeyMap::Lookup(unsigned int code) const {
+  if (code - kDenseBegin < kDenseEnd - kDenseBegin) {
+    const int button_id = dense_[code - kDenseBegin];
+    if (button_id >= 0) {
+      return button_id;
+    }
+  }
+  auto iter = std::lower_bound(sparse_.begin(), sparse_.end(), code,
+      [](const Entry& entry, unsigned int code) { return entry.code < code; });
+  if (iter != sparse_.end() && iter->code == code) {
+    return iter->button_id;
+  }
+  return -1;
+}
+
+EvdevAxisMap::EvdevAxisMap() {
+  std::fill(axis_id, axis_id + ABS_CNT, -1);
+}
+
+constexpr std::size_t EvdevLayoutCache::kMaxEntries;
+
+const EvdevLayout*
+EvdevLayoutCache::Find(const struct input_id& id,
+    const unsigned long* key_bits, const unsigned long* abs_bits) const {
+  const uint64_t hash = EvdevHashBits(key_bits, abs_bits);
+  for (const Entry& entry : entries_) {
+    if (entry.hash == hash && entry.id.bustype == id.bustype &&
+        entry.id.vendor == id.vendor && entry.id.product == id.product &&
+        entry.id.version == id.version &&
+        std::equal(entry.key_bits.begin(), entry.key_bits.end(), key_bits) &&
+        std::equal(entry.abs_bits.begin(), entry.abs_bits.end(), abs_bits)) {
+      return &entry.layout;
+    }
+  }
+  return nullptr;
+}
+
+void
+EvdevLayoutCache::Insert(const struct input_id& id,
+    const unsigned long* key_bits, const unsigned long* abs_bits,
+    const EvdevLayout& layout) {
+  if (entries_.size() >= kMaxEntries) {
+    entries_.erase(entries_.begin());
+  }
+  Entry entry;
+  entry.id = id;
+  entry.hash = EvdevHashBits(key_bits, abs_bits);
+  entry.key_bits.assign(key_bits, key_bits + EvdevBitmapSize(KEY_MAX));
+  entry.abs_bits.assign(abs_bits, abs_bits + EvdevBitmapSize(ABS_MAX));
+  entry.layout = layout;
+  entries_.push_back(std::move(entry));
+}
+
+SystemImpl::SystemImpl()
+    : devices_directory_(kDevicesDirectory),
+      parent_directory_(kParentDirectory),
+      event_queue_(kEventQueueCapacity) {
+}
+
 SystemImpl::~SystemImpl() {
+  // Stop the input thread before releasing the devices. The flag also stops
+  // the input thread if it waits for room in a full queue.
+  if (input_thread_.joinable()) {
+    thread_stop_.store(true);
+    {
+      std::lock_guard<std::mutex> lock(queue_space_mutex_);
+    }
+    queue_space_.notify_all();
+    const uint64_t value = 1;
+    if (::write(thread_stop_fd_, &value, sizeof(value)) < 0) {
+      std::cerr << "Error stopping input thread: "
+          << ::strerror(errno) << std::endl;
+    }
+    input_thread_.join();
+  }
+  for (int* fd : { &thread_epoll_fd_, &thread_stop_fd_, &thread_wake_fd_ }) {
+    if (*fd >= 0) {
+      ::close(*fd);
+      *fd = -1;
+    }
+  }
+
   for (EvdevDevice& device : devices_) {
     EvdevCleanup(&device);
   }
+  if (inotify_fd_ >= 0) {
+    ::close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+  if (epoll_fd_ >= 0) {
+    ::close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
 }
 
 void
 SystemImpl::Initialize() {
+  // Create the epoll set that contains all device file descriptors.
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    std::cerr << "Error creating epoll instance: "
+        << ::strerror(errno) << std::endl;
+  }
+
+  // Create the inotify instance for device hotplug. Its descriptor is part
+  // of the epoll set so that WaitForEvents() wakes up on attach and detach.
+  inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    std::cerr << "Error creating inotify instance: "
+        << ::strerror(errno) << std::endl;
+  } else {
+    EvdevWatch(epoll_fd_, inotify_fd_, kInotifyEpollData);
+  }
   initialized_ = true;
 }
 
+void
+SystemImpl::EnableInputThread() {
+  if (!initialized_) {
+    Initialize();
+  }
+  if (threaded_) {
+    return;
+  }
+
+  // The input thread waits on its own epoll set for device input and for
+  // the stop signal. It signals queued input through the wake descriptor,
+  // which is part of the main epoll set.
+  thread_epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  thread_stop_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  thread_wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (thread_epoll_fd_ < 0 || thread_stop_fd_ < 0 || thread_wake_fd_ < 0) {
+    std::cerr << "Error creating input thread descriptors: "
+        << ::strerror(errno) << std::endl;
+    return;
+  }
+  EvdevWatch(thread_epoll_fd_, thread_stop_fd_, kThreadStopEpollData);
+  EvdevWatch(epoll_fd_, thread_wake_fd_, kThreadWakeEpollData);
+
+  // Move devices that are already attached to the input thread.
+  for (EvdevDevice& device : devices_) {
+    if (epoll_fd_ >= 0) {
+      ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, device.file_descriptor, nullptr);
+    }
+    EvdevWatch(thread_epoll_fd_, device.file_descriptor,
+        EvdevEpollData(device.device.handle));
+  }
+
+  threaded_ = true;
+  input_thread_ = std::thread(&SystemImpl::EvdevInputThread, this);
+}
+
 void
 SystemImpl::ProcessEvents() {
   if (!initialized_) {
     Initialize();
   }
-  EvdevReadInputs();
+  if (epoll_fd_ >= 0 && !threaded_) {
+    // Query the readiness of all descriptors with a single call, and only
+    // read the devices with pending input.
+    EvdevReadReady(0);
+    return;
+  }
+  BeginProcessing();
+  if (threaded_) {
+    EvdevDrainQueue();
+  } else {
+    EvdevReadInputs();
+  }
+  EndProcessing();
+}
+
+void
+SystemImpl::WaitForEvents(int timeout_ms) {
+  if (!initialized_) {
+    Initialize();
+  }
+  // Wake up in time for delayed axis changes and settling filters.
+  timeout_ms = WaitTimeout(timeout_ms);
+
+  // Sleep in the kernel until at least one device has pending input, a
+  // device has been plugged or unplugged, or the input thread has queued
+  // input.
+  if (epoll_fd_ >= 0) {
+    EvdevReadReady(timeout_ms);
+    return;
+  }
+  BeginProcessing();
+  if (threaded_) {
+    EvdevDrainQueue();
+  } else {
+    EvdevReadInputs();
+  }
+  EndProcessing();
+}
+
+int
+SystemImpl::GetPollDescriptor() {
+  if (!initialized_) {
+    Initialize();
+  }
+  // The epoll set is readable while one of its descriptors is ready.
+  return epoll_fd_;
+}
+
+bool
+SystemImpl::StartRecording(const std::string& filename) {
+  if (!recorder_.Open(filename)) {
+    return false;
+  }
+  // Record the devices that are already attached.
+  for (const EvdevDevice& device : devices_) {
+    EvdevRecordAttach(device);
+  }
+  return true;
+}
+
+void
+SystemImpl::StopRecording() {
+  recorder_.Close();
+}
+
+bool
+SystemImpl::Rumble(Device* device, float strong, float weak,
+    double duration) {
+  EvdevDevice* evdev_device = devices_.Get(device->handle);
+  if (evdev_device == nullptr || evdev_device->file_descriptor < 0 ||
+      !device->has_rumble) {
+    return false;
+  }
+  const auto magnitude = [](float value) {
+    return static_cast<uint16_t>(
+        std::max(0.0f, std::min(1.0f, value)) * 0xffff + 0.5f);
+  };
+  const uint16_t length_ms = static_cast<uint16_t>(
+      std::max(0.0, std::min(65535.0, duration * 1000.0 + 0.5)));
+  return evdev_device->rumble.Play(evdev_device->file_descriptor,
+      magnitude(strong), magnitude(weak), length_ms);
+}
+
+Device*
+SystemImpl::GetDevice(DeviceHandle handle) {
+  EvdevDevice* device = devices_.Get(handle);
+  return device != nullptr ? &device->device : nullptr;
+}
+
+double
+SystemImpl::CurrentTime() const {
+  struct timespec time;
+  ::clock_gettime(EvdevClockId(clock_), &time);
+  return static_cast<double>(time.tv_sec) +
+      static_cast<double>(time.tv_nsec) * 1e-9;
+}
+
+void
+SystemImpl::SetClock(Clock clock) {
+  System::SetClock(clock);
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  for (EvdevDevice& device : devices_) {
+    EvdevSetClock(device.file_descriptor, clock_);
+  }
 }
 
 void
@@ -85,50 +782,170 @@ SystemImpl::ScanForDevices() {
     Initialize();
   }
 
-  // Search for device files with "-event-joystick" suffix.
-  const std::string dirname = "/dev/input/by-id/";
-  const std::string suffix = "-event-joystick";
+  // Watch the device directory and perform a full scan once. Afterwards,
+  // devices are attached and detached based on inotify events only. Without
+  // inotify, fall back to scanning the directory on every call.
+  if (!directory_scanned_ || inotify_fd_ < 0) {
+    directory_scanned_ = true;
+    EvdevWatchDirectory();
+    return;
+  }
+  EvdevProcessHotplug();
+}
 
-  // Open the search directory.
-  DIR* dir = ::opendir(dirname.c_str());
+void
+SystemImpl::EvdevWatchDirectory() {
+  // The by-id directory is removed by udev when the last device with an ID
+  // is unplugged. Watch the parent directory to notice when it re-appears.
+  if (inotify_fd_ >= 0 && parent_watch_ < 0) {
+    parent_watch_ = ::inotify_add_watch(inotify_fd_,
+        parent_directory_.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+  }
+  if (inotify_fd_ >= 0) {
+    devices_watch_ = ::inotify_add_watch(inotify_fd_,
+        devices_directory_.c_str(),
+        IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR);
+  }
+
+  // Open the search directory. The watch is added before scanning so no
+  // device can slip through between the scan and the first event.
+  DIR* dir = ::opendir(devices_directory_.c_str());
   if (dir == nullptr) {
-    std::cerr << "Error opening " << dirname << ": "
-        << ::strerror(errno) << std::endl;
+    if (errno != ENOENT) {
+      std::cerr << "Error opening " << devices_directory_ << ": "
+          << ::strerror(errno) << std::endl;
+    }
     return;
   }
 
   // Scan every file.
   struct dirent* entry = nullptr;
   while ((entry = ::readdir(dir)) != nullptr) {
-    const std::string filename = dirname + entry->d_name;
+    EvdevAttachByName(entry->d_name);
+  }
+  ::closedir(dir);
+}
 
-    // Skip files without the joystick suffix.
-    if (suffix.size() > filename.size() ||
-        !std::equal(suffix.rbegin(), suffix.rend(), filename.rbegin())) {
-      continue;
+void
+SystemImpl::EvdevProcessHotplug() {
+  if (inotify_fd_ < 0) {
+    return;
+  }
+
+  // Drain all pending inotify events. Reading an empty non-blocking inotify
+  // descriptor is the only cost if nothing has changed.
+  alignas(struct inotify_event) char buffer[4096];
+  bool rescan = false;
+  bool overflow = false;
+  bool detached = false;
+  while (true) {
+    const ssize_t length = ::read(inotify_fd_, buffer, sizeof(buffer));
+    if (length <= 0) {
+      break;
     }
+    for (const char* ptr = buffer; ptr < buffer + length;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
 
-    // Skip devices that are already attached.
-    if (std::any_of(devices_.begin(), devices_.end(),
-        [filename](const EvdevDevice& device) {
-          return device.filename == filename;
-        })) {
-      continue;
+      if (event->mask & IN_Q_OVERFLOW) {
+        // The queue overflowed and events have been lost, reconcile the
+        // devices with the directory below.
+        overflow = true;
+      } else if (event->wd == parent_watch_) {
+        // The by-id directory has been (re-)created.
+        if (event->len > 0 && parent_directory_ + event->name + "/" ==
+            devices_directory_) {
+          rescan = true;
+        }
+      } else if (event->wd == devices_watch_) {
+        if (event->mask & IN_IGNORED) {
+          // The by-id directory has been removed.
+          devices_watch_ = -1;
+        } else if (event->len == 0) {
+          continue;
+        } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          EvdevAttachByName(event->name);
+        } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          const std::string filename = devices_directory_ + event->name;
+          for (EvdevDevice& device : devices_) {
+            if (device.filename == filename) {
+              EvdevCleanup(&device);
+              detached = true;
+            }
+          }
+        }
+      }
     }
+  }
 
-    // Initialize the new device.
-    EvdevInitialize(filename);
+  // After an overflow, detach the devices whose files are gone. Scanning
+  // the directory again attaches the devices whose creation was lost, and
+  // re-adds the watch if the removal of the directory was lost.
+  if (overflow) {
+    for (EvdevDevice& device : devices_) {
+      if (device.file_descriptor >= 0 &&
+          ::access(device.filename.c_str(), F_OK) != 0) {
+        EvdevCleanup(&device);
+        detached = true;
+      }
+    }
+  }
+  if (detached) {
+    EvdevDetachRemoved();
+  }
+  if (overflow || (rescan && devices_watch_ < 0)) {
+    EvdevWatchDirectory();
   }
-  ::closedir(dir);
 }
 
 void
-SystemImpl::EvdevCleanup(EvdevDevice* device) {
-  if (device->evdev != nullptr) {
-    libevdev_free(device->evdev);
-    device->evdev = nullptr;
+SystemImpl::EvdevAttachByName(const char* name) {
+  // Skip files without the joystick suffix.
+  const std::size_t name_length = std::strlen(name);
+  const std::size_t suffix_length = std::strlen(kDeviceSuffix);
+  if (suffix_length > name_length ||
+      std::strcmp(name + name_length - suffix_length, kDeviceSuffix) != 0) {
+    return;
+  }
+
+  // Skip devices that are already attached.
+  const std::string filename = devices_directory_ + name;
+  if (std::any_of(devices_.begin(), devices_.end(),
+      [&filename](const EvdevDevice& device) {
+        return device.filename == filename;
+      })) {
+    return;
   }
+
+  // Initialize the new device.
+  EvdevInitialize(filename);
+}
+
+void
+SystemImpl::EvdevDetachRemoved() {
+  // Erasing only releases the slot, iteration remains valid.
+  for (EvdevDevice& device : devices_) {
+    if (device.file_descriptor < 0) {
+      if (recorder_.IsOpen()) {
+        recorder_.WriteDetach(device.device.device_id);
+      }
+      HandleDetach(&device.device);
+      std::lock_guard<std::mutex> lock(devices_mutex_);
+      devices_.Erase(device.device.handle);
+    }
+  }
+}
+
+void
+SystemImpl::EvdevCleanup(EvdevDevice* device) {
+  // The input thread reads the device while holding the lock.
+  std::lock_guard<std::mutex> lock(devices_mutex_);
   if (device->file_descriptor >= 0) {
+    const int epoll_fd = threaded_ ? thread_epoll_fd_ : epoll_fd_;
+    if (epoll_fd >= 0) {
+      ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device->file_descriptor, nullptr);
+    }
     ::close(device->file_descriptor);
     device->file_descriptor = -1;
   }
@@ -136,126 +953,454 @@ SystemImpl::EvdevCleanup(EvdevDevice* device) {
 
 void
 SystemImpl::EvdevInitialize(const std::string& filename) {
-  EvdevDevice device;
+  // Construct the device in place, its address remains stable. The input
+  // thread only accesses the new device once it is registered below.
+  std::unique_lock<std::mutex> lock(devices_mutex_);
+  const DeviceHandle handle = devices_.Insert();
+  EvdevDevice& device = *devices_.Get(handle);
+  lock.unlock();
+  device.device.handle = handle;
   device.filename = filename;
 
-  device.file_descriptor = ::open(filename.c_str(), O_RDONLY|O_NONBLOCK);
+  // Rumble needs write access, which is often only granted for reading.
+  device.file_descriptor = ::open(filename.c_str(), O_RDWR|O_NONBLOCK);
+  const bool writable = device.file_descriptor >= 0;
+  if (!writable) {
+    device.file_descriptor = ::open(filename.c_str(), O_RDONLY|O_NONBLOCK);
+  }
   if (device.file_descriptor < 0) {
     fprintf(stderr, "Failed to open event file\n");
+    lock.lock();
+    devices_.Erase(handle);
     return;
   }
 
-  int rc = libevdev_new_from_fd(device.file_descriptor, &device.evdev);
-  if (rc < 0 || device.evdev == nullptr) {
-    fprintf(stderr, "Failed to init libevdev: %s\n", ::strerror(-rc));
+  // Query the identity and the capabilities with a few ioctl() calls.
+  // This avoids libevdev, which fetches the complete device state.
+  const int file_descriptor = device.file_descriptor;
+  struct input_id id;
+  char name[256] = {};
+  if (::ioctl(file_descriptor, EVIOCGID, &id) < 0 ||
+      ::ioctl(file_descriptor, EVIOCGNAME(sizeof(name) - 1), name) < 0) {
+    fprintf(stderr, "Failed to query device: %s\n", ::strerror(errno));
     EvdevCleanup(&device);
+    lock.lock();
+    devices_.Erase(handle);
     return;
   }
 
-  device.device.vendor_id = libevdev_get_id_vendor(device.evdev);
-  device.device.product_id = libevdev_get_id_product(device.evdev);
-  device.device.description = libevdev_get_name(device.evdev);
-  EvdevPrintEvents(device.evdev);
+  // Timestamps are taken from the selected clock.
+  EvdevSetClock(file_descriptor, clock_);
 
-  // Scan gamepad buttons.
-  device.key_map.resize(KEY_MAX);
-  int num_buttons = 0;
-  for (unsigned int i = 0; i <= KEY_MAX; i++) {
-    if (libevdev_has_event_code(device.evdev, EV_KEY, i)) {
-      device.key_map[i].button_id = num_buttons;
-      num_buttons += 1;
-    }
+  device.device.vendor_id = id.vendor;
+  device.device.product_id = id.product;
+  device.device.description = name;
+
+  // Reuse the layout of a device with the same identity and capabilities.
+  // Otherwise, probe the buttons and axes.
+  unsigned long key_bits[EvdevBitmapSize(KEY_MAX)];
+  unsigned long abs_bits[EvdevBitmapSize(ABS_MAX)];
+  EvdevGetBits(file_descriptor, EV_KEY, key_bits, EvdevBitmapSize(KEY_MAX));
+  EvdevGetBits(file_descriptor, EV_ABS, abs_bits, EvdevBitmapSize(ABS_MAX));
+  const EvdevLayout* layout = layout_cache_.Find(id, key_bits, abs_bits);
+  if (layout != nullptr) {
+    device.layout = *layout;
+  } else {
+    EvdevProbeLayout(file_descriptor, key_bits, abs_bits, &device.layout);
+    layout_cache_.Insert(id, key_bits, abs_bits, device.layout);
+  }
+  // Resolve a mapping to the standard layout into the lookup tables, so
+  // that events are translated without extra work.
+  const Mapping* mapping = FindMapping(id.bustype, id.vendor, id.product,
+      id.version);
+  if (mapping != nullptr) {
+    std::swap(device.raw_layout, device.layout);
+    EvdevMapLayout(*mapping, device.raw_layout, &device.layout);
+    device.device.standard_layout = true;
   }
-  device.device.buttons.resize(num_buttons, false);
+  device.device.buttons.resize(device.layout.button_codes.size(), false);
+  device.device.axes.resize(device.layout.axis_infos.size(), 0.0f);
+
+  unsigned long ff_bits[EvdevBitmapSize(FF_MAX)];
+  device.device.has_rumble = writable &&
+      EvdevGetBits(file_descriptor, EV_FF, ff_bits, EvdevBitmapSize(FF_MAX)) &&
+      (ff_bits[FF_RUMBLE / kBitsPerLong] >> (FF_RUMBLE % kBitsPerLong)) & 1;
 
-  // Scan gamepad axes.
-  device.axis_map.resize(ABS_MAX);
-  int num_axes = 0;
-  for (unsigned int i = 0; i <= ABS_MAX; i++) {
-    if (libevdev_has_event_code(device.evdev, EV_ABS, i)) {
-      const struct input_absinfo* abs = libevdev_get_abs_info(device.evdev, i);
-      device.axis_map[i].axis_id = num_axes;
-      device.axis_map[i].minimum = abs->minimum;
-      device.axis_map[i].maximum = abs->maximum;
-      device.axis_map[i].flat = abs->flat;
-      device.axis_map[i].fuzz = abs->fuzz;
-      num_axes += 1;
+  if (IsLogging(LogLevel::kInfo)) {
+    std::ostringstream message;
+    message << "Attached " << filename << ": " << name << " ("
+        << std::hex << std::setfill('0') << std::setw(4) << id.vendor << ":"
+        << std::setw(4) << id.product << std::dec << "), "
+        << device.layout.button_codes.size() << " buttons, "
+        << device.layout.axis_infos.size() << " axes";
+    if (mapping != nullptr) {
+      message << ", standard layout of " << mapping->name;
     }
+    Log(LogLevel::kInfo, message.str());
   }
-  device.device.axes.resize(num_axes, 0.0f);
+  if (IsLogging(LogLevel::kDebug)) {
+    Log(LogLevel::kDebug, EvdevDescribeCapabilities(file_descriptor));
+  }
+
+  EvdevWatchDevice(device);
 
   // Assign device ID and notify client.
   device.device.device_id = next_device_id_++;
-  devices_.push_back(device);
-  if (attached_handler_) {
-    attached_handler_(&devices_.back().device);
+  if (recorder_.IsOpen()) {
+    EvdevRecordAttach(device);
   }
+  HandleAttach(&device.device);
 }
 
 void
 SystemImpl::EvdevReadInputs() {
   bool clean_up_devices = false;
   for (EvdevDevice& device : devices_) {
-    struct input_event event;
-    while (true) {
-      int rc = libevdev_next_event(device.evdev, LIBEVDEV_READ_FLAG_NORMAL, &event);
-
-      // If events have been dropped, sync up.
-      if (rc == LIBEVDEV_READ_STATUS_SYNC) {
-        while (rc == LIBEVDEV_READ_STATUS_SYNC) {
-          EvdevProcessEvent(&device, event);
-          rc = libevdev_next_event(device.evdev, LIBEVDEV_READ_FLAG_SYNC, &event);
-        }
-      }
+    if (device.file_descriptor >= 0 && !EvdevReadDevice(&device)) {
+      clean_up_devices = true;
+    }
+  }
 
-      // Process successfully read events.
-      if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-        EvdevProcessEvent(&device, event);
-        continue;
-      }
+  // Detach devices that have been removed.
+  if (clean_up_devices) {
+    EvdevDetachRemoved();
+  }
+}
 
-      // Break if no more events are pending.
-      if (rc == -EAGAIN) break;
+void
+SystemImpl::EvdevReadReady(int timeout_ms) {
+  struct epoll_event events[kMaxEpollEvents];
+  const int rc = ::epoll_wait(epoll_fd_, events, kMaxEpollEvents, timeout_ms);
+  if (rc < 0 && errno != EINTR) {
+    std::cerr << "Error waiting for events: "
+        << ::strerror(errno) << std::endl;
+  }
 
-      // Other cases are errors. Remove device.
-      EvdevCleanup(&device);
-      clean_up_devices = true;
-      break;
+  BeginProcessing();
+  bool clean_up_devices = false;
+  for (int i = 0; i < rc; ++i) {
+    const uint64_t data = events[i].data.u64;
+    if (data == kInotifyEpollData) {
+      EvdevProcessHotplug();
+    } else if (data == kThreadWakeEpollData) {
+      uint64_t value = 0;
+      if (::read(thread_wake_fd_, &value, sizeof(value)) < 0) {
+        // Nothing to reset, the descriptor is non-blocking.
+      }
+    } else {
+      // The handle of a device that has been detached in the meantime does
+      // not resolve, since its slot generation has changed.
+      EvdevDevice* device = devices_.Get(EvdevEpollHandle(data));
+      if (device != nullptr && device->file_descriptor >= 0 &&
+          !EvdevReadDevice(device)) {
+        clean_up_devices = true;
+      }
     }
   }
+  if (threaded_) {
+    EvdevDrainQueue();
+  }
 
   // Detach devices that have been removed.
   if (clean_up_devices) {
-    for (auto iter = devices_.begin(); iter != devices_.end();) {
-      if (iter->evdev == nullptr) {
-        if (detached_handler_) {
-          detached_handler_(&iter->device);
-        }
-        iter = devices_.erase(iter);
-      } else {
-        iter++;
-      }
+    EvdevDetachRemoved();
+  }
+  EndProcessing();
+}
+
+bool
+SystemImpl::EvdevReadDevice(EvdevDevice* device) {
+  // Read batches of events and process them in place. A batch that does
+  // not fill the buffer has drained the device, which saves the read()
+  // call that would only return EAGAIN.
+  ssize_t num_events = 0;
+  do {
+    std::size_t count = 0;
+    num_events = EvdevReadBatch(device, &count);
+    for (std::size_t i = 0; i < count; ++i) {
+      const struct input_event& event = device->read_buffer[i];
+      EvdevProcessEvent(device, event.type, event.code, event.value,
+          EvdevTimestamp(event));
     }
+  } while (num_events == static_cast<ssize_t>(EvdevDevice::kReadBufferSize));
+
+  // Other cases are errors. Remove device.
+  if (num_events < 0) {
+    HandleReadError(&device->device);
+    EvdevCleanup(device);
+    return false;
   }
+  return true;
 }
 
 void
-SystemImpl::EvdevProcessEvent(EvdevDevice* device, const struct input_event& event) {
-  // Not sure why this is necessary. Ignore.
-  if (event.type == EV_SYN) {
+SystemImpl::EvdevProcessEvent(EvdevDevice* device, unsigned int type,
+    unsigned int code, int value, double timestamp) {
+  if (type == kEvdevResyncType) {
+    EvdevResync(device, timestamp);
     return;
   }
-
-  if (event.type == EV_KEY) {
+  if (type == kEvdevResyncKeyType) {
+    const int button_id = device->layout.key_map.Lookup(code);
+    if (button_id >= 0 && device->device.buttons[button_id] != (value != 0)) {
+      EvdevProcessEvent(device, EV_KEY, code, value, timestamp);
+    }
+    return;
+  }
+  HandleEventRead(&device->device);
+  if (recorder_.IsOpen()) {
+    recorder_.WriteEvent(device->device.device_id, type, code, value,
+        timestamp);
+  }
+  if (type == EV_SYN) {
+    // Synchronization events delimit reports and signal dropped events.
+    if (code == SYN_REPORT) {
+      HandleReport(&device->device);
+    } else if (code == SYN_DROPPED) {
+      HandleResync(&device->device);
+    }
+  } else if (type == EV_KEY) {
     // Handle button event.
-    EvdevKeyInfo& key_info = device->key_map[event.code];
-    HandleButtonEvent(&device->device, key_info.button_id, event.value);
-  } else if (event.type == EV_ABS) {
+    const int button_id = device->layout.key_map.Lookup(code);
+    if (button_id >= 0) {
+      HandleButtonEvent(&device->device, button_id, value, timestamp);
+    }
+  } else if (type == EV_ABS && code < ABS_CNT) {
     // Handle axis event.
-    EvdevAxisInfo& axis_info = device->axis_map[event.code];
-    HandleAxisEvent(&device->device, axis_info.axis_id, event.value,
-        axis_info.minimum, axis_info.maximum, axis_info.fuzz, axis_info.flat);
+    const int axis_id = device->layout.axis_map.axis_id[code];
+    if (axis_id >= 0) {
+      const EvdevAxisInfo& axis_info = device->layout.axis_infos[axis_id];
+      HandleAxisEvent(&device->device, axis_id, value,
+          axis_info.transform, timestamp);
+    } else if (axis_id == EvdevAxisMap::kButtons) {
+      EvdevProcessAxisButtons(device, code, value, timestamp);
+    }
+  }
+}
+
+void
+SystemImpl::EvdevProcessAxisButtons(EvdevDevice* device, unsigned int code,
+    int value, double timestamp) {
+  for (const EvdevAxisButtons& entry : device->layout.axis_buttons) {
+    if (entry.code != code) {
+      continue;
+    }
+    // Only report buttons that change, the axis moves in between.
+    const int button_ids[2] = { entry.negative_button, entry.positive_button };
+    const bool is_down[2] = { value < entry.negative_below,
+        value > entry.positive_above };
+    for (int i = 0; i < 2; ++i) {
+      if (button_ids[i] >= 0 &&
+          device->device.buttons[button_ids[i]] != is_down[i]) {
+        HandleButtonEvent(&device->device, button_ids[i], is_down[i] ? 1 : 0,
+            timestamp);
+      }
+    }
+  }
+}
+
+void
+SystemImpl::EvdevResync(EvdevDevice* device, double timestamp) {
+  // Query the current state after dropped events, and process the changes
+  // like regular events, terminated by a report. Unchanged axis values are
+  // filtered like regular axis events.
+  std::vector<EvdevEvent> events;
+  EvdevQueryState(*device, timestamp, &events);
+  for (const EvdevEvent& event : events) {
+    EvdevProcessEvent(device, event.type, event.code, event.value,
+        event.timestamp);
+  }
+}
+
+void
+SystemImpl::EvdevWatchDevice(const EvdevDevice& device) {
+  // Register the device with the main epoll set, or with the input thread.
+  EvdevWatch(threaded_ ? thread_epoll_fd_ : epoll_fd_,
+      device.file_descriptor, EvdevEpollData(device.device.handle));
+}
+
+void
+SystemImpl::EvdevWatch(int epoll_fd, int file_descriptor, uint64_t data) {
+  if (epoll_fd < 0) {
+    return;
+  }
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = data;
+  if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, file_descriptor, &event) < 0) {
+    std::cerr << "Error adding descriptor to epoll set: "
+        << ::strerror(errno) << std::endl;
+  }
+}
+
+void
+SystemImpl::EvdevInputThread() {
+  struct epoll_event events[kMaxEpollEvents];
+  while (true) {
+    const int rc = ::epoll_wait(thread_epoll_fd_, events, kMaxEpollEvents, -1);
+    if (rc < 0 && errno != EINTR) {
+      std::cerr << "Error waiting for input: "
+          << ::strerror(errno) << std::endl;
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(devices_mutex_);
+    for (int i = 0; i < rc; ++i) {
+      if (events[i].data.u64 == kThreadStopEpollData || thread_stop_.load()) {
+        return;
+      }
+      EvdevQueueInputs(EvdevEpollHandle(events[i].data.u64), &lock);
+    }
+    lock.unlock();
+    EvdevWakeMainThread();
+  }
+}
+
+void
+SystemImpl::EvdevQueueInputs(DeviceHandle handle,
+    std::unique_lock<std::mutex>* lock) {
+  std::vector<EvdevEvent>& batch = thread_batch_;
+  ssize_t num_events = 0;
+  do {
+    // The device is looked up again for every batch, because it may have
+    // been detached while the lock was released.
+    EvdevDevice* device = devices_.Get(handle);
+    if (device == nullptr || device->file_descriptor < 0) {
+      return;
+    }
+
+    std::size_t count = 0;
+    num_events = EvdevReadBatch(device, &count);
+    if (num_events < 0) {
+      // Stop reading the device and let the main thread remove it.
+      ::epoll_ctl(thread_epoll_fd_, EPOLL_CTL_DEL, device->file_descriptor,
+          nullptr);
+      EvdevEvent queued;
+      queued.handle = handle;
+      queued.type = kEvdevErrorType;
+      EvdevQueueEvent(queued, lock);
+      return;
+    }
+
+    // Copy the batch, queueing may release the lock. After dropped events,
+    // query the device state now and queue it in place of the resync
+    // marker, so that it is ordered before the events read later. The main
+    // thread only processes the changes, since it owns the device state.
+    batch.clear();
+    for (std::size_t i = 0; i < count; ++i) {
+      const struct input_event& event = device->read_buffer[i];
+      if (event.type == kEvdevResyncType) {
+        EvdevQueryState(*device, EvdevTimestamp(event), &batch);
+        continue;
+      }
+      EvdevEvent queued;
+      queued.handle = handle;
+      queued.type = event.type;
+      queued.code = event.code;
+      queued.value = event.value;
+      queued.timestamp = EvdevTimestamp(event);
+      batch.push_back(queued);
+    }
+    for (const EvdevEvent& queued : batch) {
+      if (!EvdevQueueEvent(queued, lock)) {
+        return;
+      }
+    }
+  } while (num_events == static_cast<ssize_t>(EvdevDevice::kReadBufferSize));
+}
+
+bool
+SystemImpl::EvdevQueueEvent(const EvdevEvent& event,
+    std::unique_lock<std::mutex>* lock) {
+  // If the queue is full, wait for the main thread to make room. Release
+  // the lock meanwhile, so that the main thread can detach devices. Give up
+  // if the system is destroyed instead.
+  while (!event_queue_.Push(event)) {
+    lock->unlock();
+    EvdevWakeMainThread();
+    {
+      std::unique_lock<std::mutex> space_lock(queue_space_mutex_);
+      queue_space_.wait(space_lock, [this]() {
+        return thread_stop_.load() || event_queue_.Available() > 0;
+      });
+    }
+    lock->lock();
+    if (thread_stop_.load()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+SystemImpl::EvdevWakeMainThread() {
+  const uint64_t value = 1;
+  if (::write(thread_wake_fd_, &value, sizeof(value)) < 0) {
+    // The counter is saturated, the main thread wakes up anyway.
+  }
+}
+
+void
+SystemImpl::EvdevDrainQueue() {
+  // Limit processing to the events currently in the queue. This prevents
+  // running this function forever if input is faster than processing.
+  bool clean_up_devices = false;
+  EvdevEvent event;
+  const std::size_t num_queued = event_queue_.Size();
+  for (std::size_t num_events = num_queued;
+      num_events > 0 && event_queue_.Pop(&event); --num_events) {
+    // Skip events of devices that have been detached in the meantime.
+    EvdevDevice* device = devices_.Get(event.handle);
+    if (device == nullptr || device->file_descriptor < 0) {
+      continue;
+    }
+    if (event.type == kEvdevErrorType) {
+      HandleReadError(&device->device);
+      EvdevCleanup(device);
+      clean_up_devices = true;
+      continue;
+    }
+    EvdevProcessEvent(device, event.type, event.code, event.value,
+        event.timestamp);
+  }
+
+  // Wake up the input thread if it waits for room in the queue. It checks
+  // the queue under the mutex, so the notification cannot get lost.
+  if (num_queued > 0) {
+    {
+      std::lock_guard<std::mutex> lock(queue_space_mutex_);
+    }
+    queue_space_.notify_one();
+  }
+
+  // Detach devices that have been removed.
+  if (clean_up_devices) {
+    EvdevDetachRemoved();
+  }
+}
+
+void
+SystemImpl::EvdevRecordAttach(const EvdevDevice& device) {
+  RecordedDevice recorded;
+  recorded.device_id = device.device.device_id;
+  recorded.vendor_id = device.device.vendor_id;
+  recorded.product_id = device.device.product_id;
+  recorded.description = device.device.description;
+  // Recordings keep the raw input and the layout of the device.
+  const EvdevLayout& layout = device.device.standard_layout
+      ? device.raw_layout : device.layout;
+  recorded.button_codes.assign(layout.button_codes.begin(),
+      layout.button_codes.end());
+  for (const EvdevAxisInfo& axis_info : layout.axis_infos) {
+    RecordedAxis axis;
+    axis.code = axis_info.code;
+    axis.minimum = axis_info.minimum;
+    axis.maximum = axis_info.maximum;
+    axis.fuzz = axis_info.fuzz;
+    axis.flat = axis_info.flat;
+    recorded.axes.push_back(axis);
   }
+  recorder_.WriteAttach(recorded);
 }
 
 }  // namespace gamepad
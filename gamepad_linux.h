@@ -6,52 +6,263 @@
 #define GAMEPAD_LINUX_HEADER
 #ifdef __linux__
 
-#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "gamepad.h"
+#include "gamepad_record.h"
+#include "gamepad_ring_buffer.h"
+#include "gamepad_slot_map.h"
 
 namespace gamepad {
 
-struct EvdevKeyInfo {
-  int button_id = -1;
+// Maps EV_KEY codes to button IDs. Codes in the BTN_* range, which covers
+// the buttons of typical gamepads and joysticks, are looked up in a small
+// dense table. All other codes are kept in a sorted list.
+class EvdevKeyMap {
+ public:
+  EvdevKeyMap();
+  // Adds a mapping. Codes must be added in increasing order.
+  void Add(unsigned int code, int button_id);
+  // Returns the button ID for the code, or -1 if the code is not mapped.
+  int Lookup(unsigned int code) const;
+
+ private:
+  static constexpr unsigned int kDenseBegin = BTN_MISC;
+  static constexpr unsigned int kDenseEnd = BTN_MISC + 0x60;
+
+  struct Entry {
+    uint16_t code;
+    int16_t button_id;
+  };
+
+  int8_t dense_[kDenseEnd - kDenseBegin];
+  std::vector<Entry> sparse_;
+};
+
+// Maps EV_ABS codes to axis IDs. The table fits into a cache line.
+struct EvdevAxisMap {
+  // Marks codes of axes that drive buttons, see EvdevAxisButtons.
+  static constexpr int8_t kButtons = -2;
+
+  EvdevAxisMap();
+  int8_t axis_id[ABS_CNT];
 };
 
+// The buttons driven by an axis, like a hat that is mapped to the buttons
+// of the directional pad. A button is down while the value is below or
+// above the threshold.
+struct EvdevAxisButtons {
+  unsigned int code = 0;
+  int negative_button = -1;
+  int positive_button = -1;
+  int negative_below = 0;
+  int positive_above = 0;
+};
+
+// Axis information, indexed by axis ID.
 struct EvdevAxisInfo {
-  int axis_id = -1;
+  unsigned int code = 0;
   int minimum = 0;
   int maximum = 0;
   int flat = 0;
   int fuzz = 0;
+  AxisTransform transform;
+};
+
+// The buttons and axes of a device and their lookup tables, derived from
+// the capabilities of the device, or from a mapping to the standard layout.
+// In the standard layout, unmapped buttons have code KEY_RESERVED and
+// unmapped axes have code ABS_CNT.
+struct EvdevLayout {
+  EvdevKeyMap key_map;
+  // Event codes of the buttons, indexed by button ID.
+  std::vector<uint16_t> button_codes;
+  EvdevAxisMap axis_map;
+  std::vector<EvdevAxisInfo> axis_infos;
+  std::vector<EvdevAxisButtons> axis_buttons;
+};
+
+// Caches the layouts of attached devices. A device that attaches again
+// with the same identity and capabilities, like a reconnecting Bluetooth
+// pad, reuses the layout instead of probing its axes and building the
+// lookup tables again. Entries are keyed by the input ID and a hash of the
+// key and axis capability bitmaps, and validated against the bitmaps.
+class EvdevLayoutCache {
+ public:
+  // Returns the layout for the identity and capabilities, or nullptr. The
+  // bitmaps are the EV_KEY and EV_ABS bitmaps returned by EVIOCGBIT.
+  const EvdevLayout* Find(const struct input_id& id,
+      const unsigned long* key_bits, const unsigned long* abs_bits) const;
+  // Adds a layout. Evicts the oldest layout if the cache is full.
+  void Insert(const struct input_id& id, const unsigned long* key_bits,
+      const unsigned long* abs_bits, const EvdevLayout& layout);
+  void Clear() { entries_.clear(); }
+
+ private:
+  static constexpr std::size_t kMaxEntries = 32;
+
+  struct Entry {
+    struct input_id id;
+    uint64_t hash;
+    std::vector<unsigned long> key_bits;
+    std::vector<unsigned long> abs_bits;
+    EvdevLayout layout;
+  };
+
+  std::vector<Entry> entries_;
+};
+
+// The rumble effect of a device. The effect is uploaded with EVIOCSFF on
+// first use and uploaded again only if its parameters change. Playing and
+// stopping write an EV_FF event, which does not block. The kernel erases
+// the effect when the device file is closed. Works with any descriptor that
+// accepts these calls, like a uinput force-feedback device.
+class EvdevRumble {
+ public:
+  // Plays the effect with the magnitudes for the length, or stops it if
+  // the magnitudes or the length are zero. Returns false on error.
+  bool Play(int file_descriptor, uint16_t strong, uint16_t weak,
+      uint16_t length_ms);
+ private:
+  bool Upload(int file_descriptor, uint16_t strong, uint16_t weak,
+      uint16_t length_ms);
+  bool Write(int file_descriptor, int value);
+
+ private:
+  // The ID of the uploaded effect, or -1.
+  int effect_id_ = -1;
+  uint16_t strong_ = 0;
+  uint16_t weak_ = 0;
+  uint16_t length_ms_ = 0;
+  bool playing_ = false;
 };
 
 struct EvdevDevice {
+  // Number of events read per read() call.
+  static constexpr std::size_t kReadBufferSize = 64;
+
   std::string filename;
+  // The device file, or -1 once the device has been removed.
   int file_descriptor = -1;
-  struct libevdev* evdev = nullptr;
   Device device;
-  std::vector<EvdevKeyInfo> key_map;
-  std::vector<EvdevAxisInfo> axis_map;
+  EvdevLayout layout;
+  // The layout of the device before mapping it to the standard layout.
+  // Only set if the device is mapped, recordings use it.
+  EvdevLayout raw_layout;
+  EvdevRumble rumble;
+  // Events of the last read() call, processed in place.
+  struct input_event read_buffer[kReadBufferSize];
+  // True while skipping the incomplete events after a SYN_DROPPED.
+  bool dropped = false;
+};
+
+// A compact input event, queued by the input thread.
+struct EvdevEvent {
+  DeviceHandle handle;
+  uint16_t type = 0;
+  uint16_t code = 0;
+  int32_t value = 0;
+  double timestamp = 0.0;
 };
 
 class SystemImpl : public System {
  public:
-  SystemImpl() = default;
+  SystemImpl();
   ~SystemImpl() override;
   void ProcessEvents() override;
+  void WaitForEvents(int timeout_ms) override;
+  int GetPollDescriptor() override;
   void ScanForDevices() override;
+  Device* GetDevice(DeviceHandle handle) override;
+  void SetClock(Clock clock) override;
+  void EnableInputThread() override;
+  bool StartRecording(const std::string& filename) override;
+  void StopRecording() override;
+  bool Rumble(Device* device, float strong, float weak,
+      double duration) override;
+
+ protected:
+  double CurrentTime() const override;
 
  private:
+  // Benchmarks access the evdev internals.
+  friend class SystemImplPeer;
+
   void Initialize();
+  void EvdevWatchDirectory();
+  void EvdevProcessHotplug();
+  void EvdevAttachByName(const char* name);
+  void EvdevDetachRemoved();
   void EvdevCleanup(EvdevDevice* device);
   void EvdevInitialize(const std::string& filename);
+  // Reads all devices. Used if epoll is not available.
   void EvdevReadInputs();
-  void EvdevProcessEvent(EvdevDevice* device, const struct input_event& event);
+  // Waits for ready descriptors and only reads the devices with input.
+  void EvdevReadReady(int timeout_ms);
+  // Reads and processes the pending events. Returns false on error, the
+  // device is then cleaned up.
+  bool EvdevReadDevice(EvdevDevice* device);
+  void EvdevProcessEvent(EvdevDevice* device, unsigned int type,
+      unsigned int code, int value, double timestamp);
+  void EvdevProcessAxisButtons(EvdevDevice* device, unsigned int code,
+      int value, double timestamp);
+  void EvdevResync(EvdevDevice* device, double timestamp);
+  void EvdevWatchDevice(const EvdevDevice& device);
+  void EvdevWatch(int epoll_fd, int file_descriptor, uint64_t data);
+  void EvdevInputThread();
+  void EvdevQueueInputs(DeviceHandle handle,
+      std::unique_lock<std::mutex>* lock);
+  // Returns false if the input thread is stopping and the event has been
+  // dropped.
+  bool EvdevQueueEvent(const EvdevEvent& event,
+      std::unique_lock<std::mutex>* lock);
+  void EvdevWakeMainThread();
+  void EvdevDrainQueue();
+  void EvdevRecordAttach(const EvdevDevice& device);
 
  private:
   bool initialized_ = false;
+  bool directory_scanned_ = false;
   int next_device_id_ = 0;
-  std::vector<EvdevDevice> devices_;
+  // The directory of the device files and its parent directory, both with
+  // a trailing slash.
+  std::string devices_directory_;
+  std::string parent_directory_;
+  int epoll_fd_ = -1;
+  int inotify_fd_ = -1;
+  int parent_watch_ = -1;
+  int devices_watch_ = -1;
+  SlotMap<EvdevDevice> devices_;
+  EvdevLayoutCache layout_cache_;
+
+  // The input thread reads devices registered with its own epoll set and
+  // queues the events. The device table is only modified by the main
+  // thread, while holding the mutex.
+  bool threaded_ = false;
+  std::thread input_thread_;
+  int thread_epoll_fd_ = -1;
+  int thread_stop_fd_ = -1;
+  int thread_wake_fd_ = -1;
+  std::mutex devices_mutex_;
+  SpscRingBuffer<EvdevEvent> event_queue_;
+  // The events of a read() call of the input thread, before queueing.
+  std::vector<EvdevEvent> thread_batch_;
+  // Set when the input thread must stop. The input thread waits on the
+  // condition while the queue is full, until the main thread makes room or
+  // sets the flag.
+  std::atomic<bool> thread_stop_{false};
+  std::mutex queue_space_mutex_;
+  std::condition_variable queue_space_;
+
+  // Records the raw input if recording has been started.
+  Recorder recorder_;
 };
 
 }  // namespace gamepad
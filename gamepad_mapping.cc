@@ -0,0 +1,368 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_mapping.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+namespace gamepad {
+namespace {
+
+#ifdef __APPLE__
+constexpr char kPlatform[] = "Mac OS X";
+#else
+constexpr char kPlatform[] = "Linux";
+#endif
+
+constexpr char kPlatformField[] = "platform:";
+
+// A field of a mapping line and the standard button or axis it maps.
+struct MappingField {
+  const char* name;
+  std::size_t length;
+  bool is_axis;
+  int id;
+};
+
+// Sorted by name, like the fields of gamecontrollerdb.txt.
+const MappingField kFields[] = {
+  { "a", 1, false, StandardLayout::kSouth },
+  { "b", 1, false, StandardLayout::kEast },
+  { "back", 4, false, StandardLayout::kBack },
+  { "dpdown", 6, false, StandardLayout::kDpadDown },
+  { "dpleft", 6, false, StandardLayout::kDpadLeft },
+  { "dpright", 7, false, StandardLayout::kDpadRight },
+  { "dpup", 4, false, StandardLayout::kDpadUp },
+  { "guide", 5, false, StandardLayout::kGuide },
+  { "leftshoulder", 12, false, StandardLayout::kLeftShoulder },
+  { "leftstick", 9, false, StandardLayout::kLeftStick },
+  { "lefttrigger", 11, true, StandardLayout::kLeftTrigger },
+  { "leftx", 5, true, StandardLayout::kLeftX },
+  { "lefty", 5, true, StandardLayout::kLeftY },
+  { "misc1", 5, false, StandardLayout::kMisc },
+  { "rightshoulder", 13, false, StandardLayout::kRightShoulder },
+  { "rightstick", 10, false, StandardLayout::kRightStick },
+  { "righttrigger", 12, true, StandardLayout::kRightTrigger },
+  { "rightx", 6, true, StandardLayout::kRightX },
+  { "righty", 6, true, StandardLayout::kRightY },
+  { "start", 5, false, StandardLayout::kStart },
+  { "x", 1, false, StandardLayout::kWest },
+  { "y", 1, false, StandardLayout::kNorth },
+};
+constexpr std::size_t kNumFields = sizeof(kFields) / sizeof(kFields[0]);
+
+// Returns the field with the name, or nullptr. The search starts at the
+// hint and wraps around. The hint is advanced past the field found, so
+// sorted fields are usually found with the first comparison.
+const MappingField* FindField(const char* name, std::size_t length,
+    std::size_t* hint) {
+  std::size_t index = *hint;
+  for (std::size_t i = 0; i < kNumFields; ++i, ++index) {
+    if (index == kNumFields) {
+      index = 0;
+    }
+    const MappingField& field = kFields[index];
+    if (field.length == length && field.name[0] == name[0] &&
+        std::memcmp(field.name, name, length) == 0) {
+      *hint = index + 1;
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the first occurrence of the character, or end.
+const char* FindChar(const char* begin, const char* end, char c) {
+  const void* found = std::memchr(begin, c, end - begin);
+  return found != nullptr ? static_cast<const char*>(found) : end;
+}
+
+// Returns the value of a hex digit, or -1.
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Parses the GUID, which consists of little-endian 16-bit words: bus, CRC,
+// vendor, zero, product, zero, version and driver data. Returns false for
+// malformed GUIDs and for GUIDs without vendor and product, which SDL
+// derives from the device name.
+bool ParseGuid(const char* begin, const char* end, Mapping* mapping) {
+  if (end - begin != 32) {
+    return false;
+  }
+  uint16_t words[8];
+  for (int i = 0; i < 8; ++i) {
+    int bytes[2];
+    for (int j = 0; j < 2; ++j) {
+      const int high = HexDigit(begin[i * 4 + j * 2]);
+      const int low = HexDigit(begin[i * 4 + j * 2 + 1]);
+      if (high < 0 || low < 0) {
+        return false;
+      }
+      bytes[j] = high * 16 + low;
+    }
+    words[i] = static_cast<uint16_t>(bytes[0] | bytes[1] << 8);
+  }
+  if (words[3] != 0 || words[5] != 0) {
+    return false;
+  }
+  mapping->bus = words[0];
+  mapping->vendor = words[2];
+  mapping->product = words[4];
+  mapping->version = words[6];
+  return true;
+}
+
+// Parses a decimal number of at most 255 at the position.
+bool ParseIndex(const char** position, const char* end, uint8_t* index) {
+  const char* p = *position;
+  int value = 0;
+  while (p < end && *p >= '0' && *p <= '9' && value <= 255) {
+    value = value * 10 + (*p - '0');
+    ++p;
+  }
+  if (p == *position || value > 255) {
+    return false;
+  }
+  *index = static_cast<uint8_t>(value);
+  *position = p;
+  return true;
+}
+
+// Parses a source like "b3", "a2", "-a1", "a5~" or "h0.4".
+bool ParseSource(const char* begin, const char* end, MappingSource* source) {
+  const char* p = begin;
+  if (p < end && (*p == '+' || *p == '-')) {
+    source->half = *p == '+' ? 1 : -1;
+    ++p;
+  }
+  if (p == end) {
+    return false;
+  }
+  switch (*p++) {
+    case 'b': source->type = MappingSource::kButton; break;
+    case 'a': source->type = MappingSource::kAxis; break;
+    case 'h': source->type = MappingSource::kHat; break;
+    default: return false;
+  }
+  if (!ParseIndex(&p, end, &source->index)) {
+    return false;
+  }
+  if (source->type == MappingSource::kHat) {
+    if (p == end || *p++ != '.' || !ParseIndex(&p, end, &source->hat_mask)) {
+      return false;
+    }
+  }
+  if (p < end && *p == '~') {
+    source->inverted = true;
+    ++p;
+  }
+  if (source->half != 0 && source->type != MappingSource::kAxis) {
+    return false;
+  }
+  return p == end;
+}
+
+// Returns the platform field of the line, or nullptr. The platform is
+// usually the last field, so the fields are searched from the end.
+const char* FindPlatform(const char* begin, const char* end) {
+  const std::size_t length = sizeof(kPlatformField) - 1;
+  const char* field_end = end;
+  while (field_end > begin) {
+    const char* field = field_end;
+    while (field > begin && field[-1] != ',') {
+      --field;
+    }
+    if (static_cast<std::size_t>(field_end - field) >= length &&
+        std::memcmp(field, kPlatformField, length) == 0) {
+      return field;
+    }
+    field_end = field - 1;
+  }
+  return nullptr;
+}
+
+// Parses a mapping line without the line break. Returns false for comments,
+// malformed lines and lines of other platforms.
+bool ParseLine(const char* begin, const char* end, const char* platform,
+    std::size_t platform_length, Mapping* mapping) {
+  while (begin < end && (*begin == ' ' || *begin == '\t')) {
+    ++begin;
+  }
+  if (begin == end || *begin == '#') {
+    return false;
+  }
+
+  // Skip lines of other platforms before parsing anything else.
+  const char* platform_field = FindPlatform(begin, end);
+  if (platform_field != nullptr) {
+    const char* value = platform_field + sizeof(kPlatformField) - 1;
+    const char* value_end = FindChar(value, end, ',');
+    if (static_cast<std::size_t>(value_end - value) != platform_length ||
+        std::memcmp(value, platform, platform_length) != 0) {
+      return false;
+    }
+  }
+
+  const char* guid_end = FindChar(begin, end, ',');
+  if (guid_end == end || !ParseGuid(begin, guid_end, mapping)) {
+    return false;
+  }
+
+  const char* name = guid_end + 1;
+  const char* name_end = FindChar(name, end, ',');
+  mapping->name.assign(name, name_end);
+  std::size_t hint = 0;
+  for (const char* field = name_end; field < end;) {
+    field += 1;
+    const char* field_end = FindChar(field, end, ',');
+    const char* colon = FindChar(field, field_end, ':');
+    const MappingField* info = colon != field_end
+        ? FindField(field, colon - field, &hint) : nullptr;
+    MappingSource source;
+    if (info != nullptr && ParseSource(colon + 1, field_end, &source)) {
+      if (!info->is_axis) {
+        mapping->buttons[info->id] = source;
+      } else if (source.type == MappingSource::kAxis && source.half == 0) {
+        mapping->axes[info->id] = source;
+      }
+    }
+    field = field_end;
+  }
+  return true;
+}
+
+}  // namespace
+
+int
+MappingDatabase::Parse(const char* text, std::size_t size) {
+  return Parse(text, size, kPlatform);
+}
+
+int
+MappingDatabase::Parse(const char* text, std::size_t size,
+    const char* platform) {
+  const std::size_t platform_length = std::strlen(platform);
+  const char* end = text + size;
+  int num_added = 0;
+  Mapping mapping;
+  for (const char* line = text; line < end;) {
+    const char* line_end = static_cast<const char*>(
+        std::memchr(line, '\n', end - line));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+    const char* next = line_end < end ? line_end + 1 : end;
+    if (line_end > line && line_end[-1] == '\r') {
+      line_end -= 1;
+    }
+    if (ParseLine(line, line_end, platform, platform_length, &mapping)) {
+      Insert(std::move(mapping));
+      mapping = Mapping();
+      num_added += 1;
+    }
+    line = next;
+  }
+  return num_added;
+}
+
+bool
+MappingDatabase::Load(const std::string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file.good()) {
+    std::cerr << "Error opening mapping database " << filename << std::endl;
+    return false;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  const std::string text = contents.str();
+  Parse(text.data(), text.size());
+  return true;
+}
+
+const Mapping*
+MappingDatabase::Find(uint16_t bus, uint16_t vendor, uint16_t product,
+    uint16_t version) const {
+  if (slots_.empty()) {
+    return nullptr;
+  }
+  std::size_t slot = FindSlot(Key(bus, vendor, product, version));
+  if (slots_[slot].index == 0 && version != 0) {
+    slot = FindSlot(Key(bus, vendor, product, 0));
+  }
+  const uint32_t index = slots_[slot].index;
+  return index != 0 ? &mappings_[index - 1] : nullptr;
+}
+
+void
+MappingDatabase::Clear() {
+  mappings_.clear();
+  slots_.clear();
+}
+
+uint64_t
+MappingDatabase::Key(uint16_t bus, uint16_t vendor, uint16_t product,
+    uint16_t version) {
+  return static_cast<uint64_t>(bus) << 48 |
+      static_cast<uint64_t>(vendor) << 32 |
+      static_cast<uint64_t>(product) << 16 | version;
+}
+
+std::size_t
+MappingDatabase::FindSlot(uint64_t key) const {
+  // Fibonacci hashing, then linear probing. At most half of the slots are
+  // used, so probing ends at an empty slot.
+  const std::size_t mask = slots_.size() - 1;
+  std::size_t slot = (key * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+  while (slots_[slot].index != 0 && slots_[slot].key != key) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void
+MappingDatabase::Insert(Mapping&& mapping) {
+  if (2 * (mappings_.size() + 1) > slots_.size()) {
+    Rehash(std::max<std::size_t>(64, 2 * slots_.size()));
+  }
+  const uint64_t key = Key(mapping.bus, mapping.vendor, mapping.product,
+      mapping.version);
+  Slot& slot = slots_[FindSlot(key)];
+  if (slot.index != 0) {
+    mappings_[slot.index - 1] = std::move(mapping);
+    return;
+  }
+  mappings_.push_back(std::move(mapping));
+  slot.key = key;
+  slot.index = static_cast<uint32_t>(mappings_.size());
+}
+
+void
+MappingDatabase::Rehash(std::size_t num_slots) {
+  slots_.assign(num_slots, Slot{ 0, 0 });
+  for (std::size_t i = 0; i < mappings_.size(); ++i) {
+    const Mapping& mapping = mappings_[i];
+    const uint64_t key = Key(mapping.bus, mapping.vendor, mapping.product,
+        mapping.version);
+    Slot& slot = slots_[FindSlot(key)];
+    slot.key = key;
+    slot.index = static_cast<uint32_t>(i + 1);
+  }
+}
+
+}  // namespace gamepad
@@ -0,0 +1,114 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_MAPPING_HEADER
+#define GAMEPAD_MAPPING_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gamepad {
+
+// The button and axis IDs of devices in the standard layout. The face
+// buttons are named by position, like on an Xbox controller (south is A).
+// Stick axes are in [-1, 1] with positive values right and down, triggers
+// are in [0, 1].
+struct StandardLayout {
+  enum Button {
+    kSouth, kEast, kWest, kNorth,
+    kBack, kGuide, kStart,
+    kLeftStick, kRightStick, kLeftShoulder, kRightShoulder,
+    kDpadUp, kDpadDown, kDpadLeft, kDpadRight,
+    kMisc,
+    kNumButtons
+  };
+  enum Axis {
+    kLeftX, kLeftY, kRightX, kRightY,
+    kLeftTrigger, kRightTrigger,
+    kNumAxes
+  };
+};
+
+// The input of the device that a button or axis of the standard layout is
+// mapped to. Indices are in the order of SDL, see MappingDatabase.
+struct MappingSource {
+  enum Type : uint8_t { kNone, kButton, kAxis, kHat };
+
+  Type type = kNone;
+  // The button, axis or hat index.
+  uint8_t index = 0;
+  // For hats, the direction: 1 is up, 2 right, 4 down and 8 left.
+  uint8_t hat_mask = 0;
+  // For axes, -1 or 1 if only the negative or positive half is used.
+  int8_t half = 0;
+  bool inverted = false;
+};
+
+// The mapping of a device model to the standard layout.
+struct Mapping {
+  // The device identity, as reported by the kernel on Linux.
+  uint16_t bus = 0;
+  uint16_t vendor = 0;
+  uint16_t product = 0;
+  uint16_t version = 0;
+  std::string name;
+  MappingSource buttons[StandardLayout::kNumButtons];
+  MappingSource axes[StandardLayout::kNumAxes];
+};
+
+// A database of mappings in the format of SDL's gamecontrollerdb.txt, one
+// mapping per line:
+//   GUID,name,a:b0,b:b1,...,leftx:a0,dpup:h0.1,...,platform:Linux,
+// The GUID encodes bus, vendor, product and version. Buttons are numbered
+// like SDL does on Linux: BTN_JOYSTICK and higher codes first, then the
+// lower codes. Axes are numbered in code order without the hats, and hats
+// are numbered in code order. Mappings to half of an output axis, and
+// mappings of buttons to axes, are not supported and ignored.
+//
+// Mappings are indexed by identity in an open-addressing hash table, so a
+// lookup at attach time costs a few probes.
+class MappingDatabase {
+ public:
+  // Adds the mappings of the text for the platform ("Linux" or "Mac OS X",
+  // defaults to the current platform). Lines for other platforms are
+  // skipped, lines without platform are used. A mapping replaces earlier
+  // mappings of the same identity. Returns the number of mappings added.
+  int Parse(const char* text, std::size_t size);
+  int Parse(const char* text, std::size_t size, const char* platform);
+  // Parses the database file. Returns false if the file cannot be read.
+  bool Load(const std::string& filename);
+
+  // Returns the mapping for the identity, or the mapping for the identity
+  // with version zero, or nullptr.
+  const Mapping* Find(uint16_t bus, uint16_t vendor, uint16_t product,
+      uint16_t version) const;
+  std::size_t Size() const { return mappings_.size(); }
+  void Clear();
+
+ private:
+  static uint64_t Key(uint16_t bus, uint16_t vendor, uint16_t product,
+      uint16_t version);
+  // Returns the slot of the key, or the empty slot to insert it into.
+  std::size_t FindSlot(uint64_t key) const;
+  void Insert(Mapping&& mapping);
+  void Rehash(std::size_t num_slots);
+
+ private:
+  // A slot of the index holds the key and the index of the mapping plus
+  // one, or zero if the slot is empty.
+  struct Slot {
+    uint64_t key;
+    uint32_t index;
+  };
+
+  std::vector<Mapping> mappings_;
+  // The number of slots is a power of two.
+  std::vector<Slot> slots_;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_MAPPING_HEADER
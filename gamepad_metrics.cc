@@ -0,0 +1,60 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace gamepad {
+
+constexpr int Histogram::kNumBuckets;
+
+void
+Histogram::Add(double seconds) {
+  // The bucket index is the binary exponent of the duration in microseconds.
+  const double micros = seconds * 1e6;
+  int index = 0;
+  if (micros >= 1.0) {
+    index = std::min(kNumBuckets - 1, std::ilogb(micros) + 1);
+  }
+  buckets_[index] += 1;
+  count_ += 1;
+  sum_ += seconds;
+  max_ = std::max(max_, seconds);
+}
+
+void
+Histogram::Reset() {
+  *this = Histogram();
+}
+
+double
+Histogram::BucketUpperBound(int index) {
+  if (index >= kNumBuckets - 1) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return std::ldexp(1e-6, index);
+}
+
+double
+Histogram::Mean() const {
+  return count_ > 0 ? sum_ / count_ : 0.0;
+}
+
+double
+Histogram::Percentile(double percentile) const {
+  const double rank = percentile * count_;
+  uint64_t cumulative = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    cumulative += buckets_[i];
+    if (cumulative > 0 && cumulative >= rank) {
+      return std::min(BucketUpperBound(i), max_);
+    }
+  }
+  return max_;
+}
+
+}  // namespace gamepad
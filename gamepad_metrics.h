@@ -0,0 +1,70 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_METRICS_HEADER
+#define GAMEPAD_METRICS_HEADER
+
+#include <cstdint>
+#include <vector>
+
+namespace gamepad {
+
+// A histogram of durations with fixed logarithmic buckets. Bucket zero
+// counts durations below one microsecond, bucket i counts durations in
+// [2^(i-1), 2^i) microseconds, and the last bucket counts all longer
+// durations. Adding a value never allocates.
+class Histogram {
+ public:
+  static constexpr int kNumBuckets = 25;
+
+ public:
+  // Adds a duration in seconds.
+  void Add(double seconds);
+  void Reset();
+
+  uint64_t Count() const { return count_; }
+  uint64_t Bucket(int index) const { return buckets_[index]; }
+  // Returns the upper bound of the bucket in seconds, or infinity for the
+  // last bucket.
+  static double BucketUpperBound(int index);
+  // Returns the mean and the maximum duration in seconds.
+  double Mean() const;
+  double Max() const { return max_; }
+  // Returns an upper bound for the given percentile (in [0, 1]) of the
+  // durations, which is the upper bound of the bucket that contains it.
+  double Percentile(double percentile) const;
+
+ private:
+  uint64_t buckets_[kNumBuckets] = {};
+  uint64_t count_ = 0;
+  double sum_ = 0.0;
+  double max_ = 0.0;
+};
+
+// Counters and latencies of a device, see System::GetMetrics().
+struct DeviceMetrics {
+  unsigned int device_id = 0;
+  // Raw events read from the device, including synchronization events.
+  uint64_t events_read = 0;
+  // Axis values that were not reported because the change was within the
+  // fuzz value, or because the value stayed within the flat range.
+  uint64_t events_filtered = 0;
+  // Episodes of dropped events, after which the device state was re-synced.
+  uint64_t resyncs = 0;
+  uint64_t read_errors = 0;
+  // Time from the kernel timestamp of an event to the handler invocation.
+  Histogram handler_latency;
+};
+
+// Metrics of the system and of all attached devices.
+struct Metrics {
+  std::vector<DeviceMetrics> devices;
+  // Time spent processing events per ProcessEvents() or WaitForEvents()
+  // call, excluding the time spent waiting.
+  Histogram processing_time;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_METRICS_HEADER
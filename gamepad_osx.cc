@@ -10,6 +10,9 @@
 
 #include "gamepad_osx.h"
 
+#include <mach/mach_time.h>
+#include <sys/time.h>
+
 #include <chrono>
 #include <thread>
 #include <iostream>
@@ -22,10 +25,25 @@ constexpr int kHidPageDesktop = kHIDPage_GenericDesktop;
 constexpr int kHidUsageGamepad = kHIDUsage_GD_GamePad;
 constexpr int kHidUsageJoystick = kHIDUsage_GD_Joystick;
 constexpr int kHidUsageController = kHIDUsage_GD_MultiAxisController;
+// Capacity of the event queue between the event thread and the main thread.
+constexpr std::size_t kEventQueueCapacity = 4096;
+
+// Converts a mach_absolute_time() value to seconds.
+double HidTimestamp(uint64_t mach_time) {
+  static const double seconds_per_tick = []() {
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    return static_cast<double>(timebase.numer) / timebase.denom * 1e-9;
+  }();
+  return static_cast<double>(mach_time) * seconds_per_tick;
+}
 }  // namespace
 
-SystemImpl::SystemImpl() {
+SystemImpl::SystemImpl()
+    : event_queue_(kEventQueueCapacity) {
   pthread_mutex_init(&event_queue_mutex_, nullptr);
+  pthread_cond_init(&event_queue_cond_, nullptr);
+  pthread_mutex_init(&hotplug_mutex_, nullptr);
 }
 
 SystemImpl::~SystemImpl() {
@@ -34,14 +52,19 @@ SystemImpl::~SystemImpl() {
     pthread_cancel(event_thread_);
     event_thread_loop_ = nullptr;
   }
+  pthread_cond_destroy(&event_queue_cond_);
   pthread_mutex_destroy(&event_queue_mutex_);
 
+  // Release devices of attach and detach events that were not applied.
+  for (const HidHotplugEvent& event : hotplug_events_) {
+    CFRelease(event.device_ref);
+  }
+  pthread_mutex_destroy(&hotplug_mutex_);
+
   // Clean up devices.
-  for (HidDevice* device : devices_) {
-    HidCleanup(device);
-    delete device;
+  for (HidDevice& device : devices_) {
+    HidCleanup(&device);
   }
-  devices_.clear();
 
   // Close event manager.
   if (hid_manager_ != nullptr) {
@@ -54,22 +77,62 @@ SystemImpl::~SystemImpl() {
 
 void
 SystemImpl::ProcessEvents() {
-  // Process all events in the queue.
+  // Apply attach and detach events, then process all events in the queue.
+  BeginProcessing();
+  HidProcessHotplug();
   HidProcessEvents();
 
   // Detach devices that have been removed.
-  for (auto iter = devices_.begin(); iter != devices_.end();) {
-    HidDevice* device = *iter;
-    if (device->disconnected) {
-      if (detached_handler_) {
-        detached_handler_(&device->device);
-      }
-      delete device;
-      iter = devices_.erase(iter);
+  // Erasing only releases the slot, iteration remains valid.
+  for (HidDevice& device : devices_) {
+    if (device.disconnected) {
+      HandleDetach(&device.device);
+      devices_.Erase(device.device.handle);
+    }
+  }
+  EndProcessing();
+}
+
+Device*
+SystemImpl::GetDevice(DeviceHandle handle) {
+  HidDevice* device = devices_.Get(handle);
+  return device != nullptr ? &device->device : nullptr;
+}
+
+void
+SystemImpl::WaitForEvents(int timeout_ms) {
+  // Wake up in time for delayed axis changes and settling filters.
+  timeout_ms = WaitTimeout(timeout_ms);
+  // Wait for the event thread to queue events. The event thread only takes
+  // the mutex to signal if a waiter is announced. The fences order the
+  // announcement before the check of the queue, and the push of the event
+  // thread before its check of the announcement, so at least one of the
+  // threads sees the store of the other and no wakeup is lost.
+  pthread_mutex_lock(&event_queue_mutex_);
+  event_queue_waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (event_queue_.Size() == 0) {
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&event_queue_cond_, &event_queue_mutex_);
     } else {
-      iter++;
+      struct timeval now;
+      gettimeofday(&now, nullptr);
+      const long long nsec = now.tv_usec * 1000LL + timeout_ms * 1000000LL;
+      struct timespec deadline;
+      deadline.tv_sec = now.tv_sec + nsec / 1000000000LL;
+      deadline.tv_nsec = nsec % 1000000000LL;
+      pthread_cond_timedwait(&event_queue_cond_, &event_queue_mutex_,
+          &deadline);
     }
   }
+  event_queue_waiting_.store(false, std::memory_order_relaxed);
+  pthread_mutex_unlock(&event_queue_mutex_);
+  ProcessEvents();
+}
+
+double
+SystemImpl::CurrentTime() const {
+  return HidTimestamp(mach_absolute_time());
 }
 
 void
@@ -157,13 +220,13 @@ SystemImpl::HidCleanup(HidDevice* device) {
 void
 SystemImpl::HidAttached(void* context, IOReturn result, void* sender, IOHIDDeviceRef device) {
   SystemImpl* system = static_cast<SystemImpl*>(context);
-  system->HidDeviceAttached(device);
+  system->HidQueueHotplug(device, true);
 }
 
 void
 SystemImpl::HidDetached(void* context, IOReturn result, void* sender, IOHIDDeviceRef device) {
   SystemImpl* system = static_cast<SystemImpl*>(context);
-  system->HidDeviceDetached(device);
+  system->HidQueueHotplug(device, false);
 }
 
 void
@@ -179,6 +242,39 @@ SystemImpl::EventThreadRun(void* context) {
   return nullptr;
 }
 
+void
+SystemImpl::HidQueueHotplug(IOHIDDeviceRef device, bool attached) {
+  // The HID manager may call back on another thread than the one that
+  // processes events. Keep the device alive until the event is applied,
+  // even if it is removed in the meantime.
+  CFRetain(device);
+  HidHotplugEvent event;
+  event.device_ref = device;
+  event.attached = attached;
+  pthread_mutex_lock(&hotplug_mutex_);
+  hotplug_events_.push_back(event);
+  pthread_mutex_unlock(&hotplug_mutex_);
+}
+
+void
+SystemImpl::HidProcessHotplug() {
+  // Take the queued events under the mutex, apply them without it, so that
+  // attach handlers do not block the HID manager.
+  std::vector<HidHotplugEvent> events;
+  pthread_mutex_lock(&hotplug_mutex_);
+  events.swap(hotplug_events_);
+  pthread_mutex_unlock(&hotplug_mutex_);
+
+  for (const HidHotplugEvent& event : events) {
+    if (event.attached) {
+      HidDeviceAttached(event.device_ref);
+    } else {
+      HidDeviceDetached(event.device_ref);
+    }
+    CFRelease(event.device_ref);
+  }
+}
+
 void
 SystemImpl::HidDeviceAttached(IOHIDDeviceRef device) {
   // Get vendor and product ID.
@@ -205,8 +301,10 @@ SystemImpl::HidDeviceAttached(IOHIDDeviceRef device) {
     device_name = buffer;
   }
 
-  // Create the device record.
-  HidDevice* hid_device = new HidDevice();
+  // Create the device record in place, its address remains stable.
+  const DeviceHandle handle = devices_.Insert();
+  HidDevice* hid_device = devices_.Get(handle);
+  hid_device->device.handle = handle;
   hid_device->device_ref = device;
   hid_device->parent = this;
   hid_device->device.vendor_id = vendor_id;
@@ -240,6 +338,8 @@ SystemImpl::HidDeviceAttached(IOHIDDeviceRef device) {
       axis_info.cookie = IOHIDElementGetCookie(element);
       axis_info.minimum = IOHIDElementGetLogicalMin(element);
       axis_info.maximum = IOHIDElementGetLogicalMax(element);
+      axis_info.transform = MakeAxisTransform(axis_info.minimum,
+          axis_info.maximum, axis_info.fuzz, axis_info.flat);
       hid_device->axis_infos.push_back(axis_info);
       max_cookie_id = std::max(max_cookie_id, axis_info.cookie);
     }
@@ -261,24 +361,22 @@ SystemImpl::HidDeviceAttached(IOHIDDeviceRef device) {
 
   // Assign device ID and notify client.
   hid_device->device.device_id = next_device_id_++;
-  devices_.push_back(hid_device);
-  if (attached_handler_) {
-    attached_handler_(&devices_.back()->device);
-  }
+  HandleAttach(&hid_device->device);
 
   // Open HID device and attach input callback.
   IOHIDDeviceOpen(device, kIOHIDOptionsTypeNone);
-  IOHIDDeviceRegisterInputValueCallback(device, SystemImpl::HidInput, devices_.back());
+  IOHIDDeviceRegisterInputValueCallback(device, SystemImpl::HidInput, hid_device);
   // Schedule event handling on a separate thread.
   IOHIDDeviceScheduleWithRunLoop(device, event_thread_loop_, kCFRunLoopDefaultMode);
 }
 
 void
 SystemImpl::HidDeviceDetached(IOHIDDeviceRef device) {
-  // De-allocate existing devices, fire callback later on ProcessEvents().
-  for (HidDevice* hid_device : devices_) {
-    if (hid_device->device_ref == device) {
-      HidCleanup(hid_device);
+  // De-allocate existing devices, the detach loop of ProcessEvents() fires
+  // the callback.
+  for (HidDevice& hid_device : devices_) {
+    if (hid_device.device_ref == device) {
+      HidCleanup(&hid_device);
       return;
     }
   }
@@ -303,29 +401,24 @@ SystemImpl::HidDeviceInput(HidDevice* hid_device, IOHIDValueRef value) {
 
   HidEvent event;
   event.device = hid_device;
+  event.handle = hid_device->device.handle;
   event.axis_id = cookie_info.axis_id;
   event.button_id = cookie_info.button_id;
   event.value = int_value;
+  event.timestamp = HidTimestamp(IOHIDValueGetTimeStamp(value));
 
-  pthread_mutex_lock(&event_queue_mutex_);
-  // Queue the event for processing in the main thread.
-  event_queue_.push(event);
-  // If the event queue has grown too large, compress the queue.
-  if (event_queue_.size() > 1024) {
-    HidCompressQueue();
+  // Queue the event for processing in the main thread. If the main thread
+  // does not keep up and the queue is full, the event is dropped.
+  if (!event_queue_.Push(event)) {
+    return;
+  }
+  // Pairs with the fence in WaitForEvents().
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (event_queue_waiting_.load(std::memory_order_relaxed)) {
+    pthread_mutex_lock(&event_queue_mutex_);
+    pthread_cond_signal(&event_queue_cond_);
+    pthread_mutex_unlock(&event_queue_mutex_);
   }
-  pthread_mutex_unlock(&event_queue_mutex_);
-}
-
-void
-SystemImpl::HidCompressQueue() {
-  std::cout << "Compressing event queue (size " << event_queue_.size()
-      << ")..." << std::endl;
-  pthread_mutex_lock(&event_queue_mutex_);
-  // TODO
-  while (!event_queue_.empty())
-    event_queue_.pop();
-  pthread_mutex_unlock(&event_queue_mutex_); 
 }
 
 void
@@ -333,33 +426,35 @@ SystemImpl::HidProcessEvents() {
   // Limit event processing to the events currently in the queue. This
   // potentially prevents running this function forever if event generation is
   // faster than processing.
-  pthread_mutex_lock(&event_queue_mutex_);
-  std::size_t num_events = event_queue_.size();
-  pthread_mutex_unlock(&event_queue_mutex_);
-  while (num_events > 0) {
-    // Get an event from the queue and decrement the number of events that
-    // still need to be processed. Since event queue compression may happen in
-    // the background if the queue gets too long, limit by actual queue size.
-    // Compression will always leave at least one element in the queue.
-    pthread_mutex_lock(&event_queue_mutex_);
-    HidEvent event = event_queue_.front();
-    event_queue_.pop();
-    num_events = std::min(num_events - 1, event_queue_.size());
-    pthread_mutex_unlock(&event_queue_mutex_);
+  HidEvent event;
+  for (std::size_t num_events = event_queue_.Size();
+      num_events > 0 && event_queue_.Pop(&event); --num_events) {
     HidProcessEvent(event);
   }
+
+  // HID does not delimit reports. Deliver all changes since the last call
+  // as a single frame per device.
+  for (HidDevice& device : devices_) {
+    HandleReport(&device.device);
+  }
 }
 
 void
 SystemImpl::HidProcessEvent(const HidEvent& event) {
+  // Skip events of devices that have been detached in the meantime.
   HidDevice* device = event.device;
+  if (devices_.Get(event.handle) != device) {
+    return;
+  }
+  HandleEventRead(&device->device);
   if (event.button_id >= 0) {
     const HidButtonInfo& button_info = device->button_infos[event.button_id];
-    HandleButtonEvent(&device->device, event.button_id, event.value);
+    HandleButtonEvent(&device->device, event.button_id, event.value,
+        event.timestamp);
   } else if (event.axis_id >= 0) {
     const HidAxisInfo& axis_info = device->axis_infos[event.axis_id];
     HandleAxisEvent(&device->device, event.axis_id, event.value,
-        axis_info.minimum, axis_info.maximum, axis_info.fuzz, axis_info.flat);
+        axis_info.transform, event.timestamp);
   }
 }
 
@@ -9,10 +9,12 @@
 #include <pthread.h>
 #include <CoreFoundation/CFRunLoop.h>
 #include <IOKit/hid/IOHIDManager.h>
+#include <atomic>
 #include <vector>
-#include <queue>
 
 #include "gamepad.h"
+#include "gamepad_ring_buffer.h"
+#include "gamepad_slot_map.h"
 
 namespace gamepad {
 
@@ -30,6 +32,7 @@ struct HidAxisInfo {
   int maximum = 0;
   int fuzz = 0;
   int flat = 0;
+  AxisTransform transform;
 };
 
 struct HidCookieInfo {
@@ -47,11 +50,20 @@ struct HidDevice {
   std::vector<HidCookieInfo> cookie_map;
 };
 
+// An attach or detach reported by the HID manager. The device reference is
+// retained while the event is queued.
+struct HidHotplugEvent {
+  IOHIDDeviceRef device_ref = nullptr;
+  bool attached = false;
+};
+
 struct HidEvent {
   HidDevice* device = nullptr;
+  DeviceHandle handle;
   int axis_id = -1;
   int button_id = -1;
   int value;
+  double timestamp = 0.0;
 };
 
 class SystemImpl : public System {
@@ -59,18 +71,24 @@ class SystemImpl : public System {
   SystemImpl();
   ~SystemImpl() override;
   void ProcessEvents() override;
+  void WaitForEvents(int timeout_ms) override;
   void ScanForDevices() override;
+  Device* GetDevice(DeviceHandle handle) override;
+
+ protected:
+  double CurrentTime() const override;
 
  private:
   void HidInitialize();
   void HidCleanup(HidDevice* device);
+  void HidQueueHotplug(IOHIDDeviceRef device, bool attached);
+  void HidProcessHotplug();
   void HidDeviceAttached(IOHIDDeviceRef device);
   void HidDeviceDetached(IOHIDDeviceRef device);
   void HidDeviceInput(HidDevice* hid_device, IOHIDValueRef value);
   void HidEventThread();
   void HidProcessEvents();
   void HidProcessEvent(const HidEvent& event);
-  void HidCompressQueue();
 
   static void HidAttached(
       void* context, IOReturn result, void* sender, IOHIDDeviceRef device);
@@ -84,12 +102,21 @@ class SystemImpl : public System {
   bool initialized_ = false;
   int next_device_id_ = 0;
   IOHIDManagerRef hid_manager_ = nullptr;
-  std::vector<HidDevice*> devices_;
+  SlotMap<HidDevice> devices_;
+
+  // Attach and detach events of the HID manager, applied by ProcessEvents()
+  // so that devices_ is only modified on the processing thread.
+  std::vector<HidHotplugEvent> hotplug_events_;
+  pthread_mutex_t hotplug_mutex_;
 
   pthread_t event_thread_;
   CFRunLoopRef event_thread_loop_ = nullptr;
-  std::queue<HidEvent> event_queue_;
+  // Events are queued by the event thread and processed by the main thread.
+  // The mutex and condition are only used to wake up WaitForEvents().
+  SpscRingBuffer<HidEvent> event_queue_;
+  std::atomic<bool> event_queue_waiting_{false};
   pthread_mutex_t event_queue_mutex_;
+  pthread_cond_t event_queue_cond_;
 };
 
 }  // namespace gamepad
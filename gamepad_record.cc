@@ -0,0 +1,193 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_record.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace gamepad {
+namespace {
+
+// The fixed-size part of the device information.
+struct RecordDeviceHeader {
+  int32_t vendor_id;
+  int32_t product_id;
+  uint32_t num_buttons;
+  uint32_t num_axes;
+  uint32_t description_size;
+  uint32_t reserved;
+};
+
+// The axis information, followed by the button codes and the description.
+struct RecordAxisInfo {
+  uint32_t code;
+  int32_t minimum;
+  int32_t maximum;
+  int32_t fuzz;
+  int32_t flat;
+};
+
+// Entries are padded to keep the following entries aligned.
+constexpr std::size_t kRecordAlignment = 8;
+
+// Returns the size including the padding.
+std::size_t PaddedSize(std::size_t size) {
+  return (size + kRecordAlignment - 1) / kRecordAlignment * kRecordAlignment;
+}
+
+}  // namespace
+
+constexpr char Recorder::kMagic[4];
+constexpr uint32_t Recorder::kVersion;
+
+bool
+DecodeRecordedDevice(const char* data, std::size_t size,
+    RecordedDevice* device) {
+  RecordDeviceHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  const std::size_t axes_size = header.num_axes * sizeof(RecordAxisInfo);
+  const std::size_t buttons_size = header.num_buttons * sizeof(uint16_t);
+  if (header.num_axes > kRecordAbsCount ||
+      header.num_buttons > kRecordKeyCount ||
+      size < sizeof(header) + axes_size + buttons_size +
+          header.description_size) {
+    return false;
+  }
+  device->vendor_id = header.vendor_id;
+  device->product_id = header.product_id;
+
+  const char* ptr = data + sizeof(header);
+  device->axes.resize(header.num_axes);
+  for (RecordedAxis& axis : device->axes) {
+    RecordAxisInfo info;
+    std::memcpy(&info, ptr, sizeof(info));
+    ptr += sizeof(info);
+    axis.code = info.code;
+    axis.minimum = info.minimum;
+    axis.maximum = info.maximum;
+    axis.fuzz = info.fuzz;
+    axis.flat = info.flat;
+  }
+  device->button_codes.resize(header.num_buttons);
+  for (unsigned int& code : device->button_codes) {
+    uint16_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    code = value;
+  }
+  device->description.assign(ptr, header.description_size);
+  return true;
+}
+
+Recorder::~Recorder() {
+  Close();
+}
+
+bool
+Recorder::Open(const std::string& filename) {
+  Close();
+  file_ = std::fopen(filename.c_str(), "wb");
+  if (file_ == nullptr) {
+    std::cerr << "Error creating recording " << filename << ": "
+        << std::strerror(errno) << std::endl;
+    return false;
+  }
+  RecordFileHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  Write(&header, sizeof(header));
+  last_timestamp_ = 0.0;
+  return true;
+}
+
+void
+Recorder::Close() {
+  if (file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+void
+Recorder::WriteAttach(const RecordedDevice& device) {
+  RecordDeviceHeader header;
+  header.vendor_id = device.vendor_id;
+  header.product_id = device.product_id;
+  header.num_buttons = device.button_codes.size();
+  header.num_axes = device.axes.size();
+  header.description_size = device.description.size();
+  header.reserved = 0;
+  const std::size_t size = sizeof(header) +
+      header.num_axes * sizeof(RecordAxisInfo) +
+      header.num_buttons * sizeof(uint16_t) + header.description_size;
+
+  RecordEntry entry;
+  std::memset(&entry, 0, sizeof(entry));
+  entry.kind = kRecordAttach;
+  entry.device_id = device.device_id;
+  entry.value = static_cast<int32_t>(PaddedSize(size));
+  entry.timestamp = last_timestamp_;
+  Write(&entry, sizeof(entry));
+  Write(&header, sizeof(header));
+  for (const RecordedAxis& axis : device.axes) {
+    RecordAxisInfo info;
+    info.code = axis.code;
+    info.minimum = axis.minimum;
+    info.maximum = axis.maximum;
+    info.fuzz = axis.fuzz;
+    info.flat = axis.flat;
+    Write(&info, sizeof(info));
+  }
+  for (unsigned int code : device.button_codes) {
+    const uint16_t value = static_cast<uint16_t>(code);
+    Write(&value, sizeof(value));
+  }
+  Write(device.description.data(), device.description.size());
+  const char padding[kRecordAlignment] = {};
+  Write(padding, PaddedSize(size) - size);
+}
+
+void
+Recorder::WriteDetach(unsigned int device_id) {
+  RecordEntry entry;
+  std::memset(&entry, 0, sizeof(entry));
+  entry.kind = kRecordDetach;
+  entry.device_id = device_id;
+  entry.timestamp = last_timestamp_;
+  Write(&entry, sizeof(entry));
+}
+
+void
+Recorder::WriteEvent(unsigned int device_id, unsigned int type,
+    unsigned int code, int value, double timestamp) {
+  RecordEntry entry;
+  entry.kind = kRecordEvent;
+  entry.type = static_cast<uint16_t>(type);
+  entry.code = static_cast<uint16_t>(code);
+  entry.reserved = 0;
+  entry.device_id = device_id;
+  entry.value = value;
+  entry.timestamp = timestamp;
+  Write(&entry, sizeof(entry));
+  last_timestamp_ = timestamp;
+}
+
+void
+Recorder::Write(const void* data, std::size_t size) {
+  if (file_ == nullptr || size == 0) {
+    return;
+  }
+  if (std::fwrite(data, 1, size, file_) != size) {
+    std::cerr << "Error writing recording: "
+        << std::strerror(errno) << std::endl;
+    Close();
+  }
+}
+
+}  // namespace gamepad
@@ -0,0 +1,112 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_RECORD_HEADER
+#define GAMEPAD_RECORD_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace gamepad {
+
+// Linux input event types and codes used in recordings. They are defined
+// here so that recordings can be replayed on any platform.
+constexpr uint16_t kRecordEvSyn = 0x00;
+constexpr uint16_t kRecordEvKey = 0x01;
+constexpr uint16_t kRecordEvAbs = 0x03;
+constexpr uint16_t kRecordSynReport = 0;
+constexpr uint16_t kRecordSynDropped = 3;
+constexpr unsigned int kRecordKeyCount = 0x300;
+constexpr unsigned int kRecordAbsCount = 0x40;
+
+// The recording file starts with a header, followed by a sequence of
+// entries. All values are stored in host byte order.
+struct RecordFileHeader {
+  char magic[4];
+  uint32_t version;
+};
+
+// The kind of a recording entry.
+enum RecordKind : uint16_t {
+  kRecordEvent = 0,
+  kRecordAttach = 1,
+  kRecordDetach = 2,
+};
+
+// A recording entry. Event entries contain the raw input event. Attach
+// entries are followed by the device information, which is `value` bytes
+// long, see RecordedDevice.
+struct RecordEntry {
+  uint16_t kind;
+  uint16_t type;
+  uint16_t code;
+  uint16_t reserved;
+  uint32_t device_id;
+  int32_t value;
+  double timestamp;
+};
+
+// The axis information of a recorded device.
+struct RecordedAxis {
+  unsigned int code = 0;
+  int minimum = 0;
+  int maximum = 0;
+  int fuzz = 0;
+  int flat = 0;
+};
+
+// The information of a recorded device. Buttons and axes are listed in the
+// order of their IDs, with the event code of each button and axis.
+struct RecordedDevice {
+  unsigned int device_id = 0;
+  int vendor_id = 0;
+  int product_id = 0;
+  std::string description;
+  std::vector<unsigned int> button_codes;
+  std::vector<RecordedAxis> axes;
+};
+
+// Decodes the device information that follows an attach entry. Returns
+// false if the data is malformed.
+bool DecodeRecordedDevice(const char* data, std::size_t size,
+    RecordedDevice* device);
+
+// Writes raw input events and device information to a recording file. The
+// file is written through a stdio buffer, recording costs one copy per event.
+class Recorder {
+ public:
+  static constexpr char kMagic[4] = { 'G', 'P', 'R', 'C' };
+  static constexpr uint32_t kVersion = 1;
+
+ public:
+  Recorder() = default;
+  ~Recorder();
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  // Creates the recording file. Returns false on error.
+  bool Open(const std::string& filename);
+  // Flushes and closes the recording file.
+  void Close();
+  bool IsOpen() const { return file_ != nullptr; }
+
+  void WriteAttach(const RecordedDevice& device);
+  void WriteDetach(unsigned int device_id);
+  void WriteEvent(unsigned int device_id, unsigned int type,
+      unsigned int code, int value, double timestamp);
+
+ private:
+  void Write(const void* data, std::size_t size);
+
+  std::FILE* file_ = nullptr;
+  // Attach and detach entries carry the timestamp of the last event.
+  double last_timestamp_ = 0.0;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_RECORD_HEADER
@@ -0,0 +1,313 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_replay.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+namespace gamepad {
+namespace {
+// Limits the handle table for corrupt recordings.
+constexpr unsigned int kMaxDeviceId = 0xffff;
+}  // namespace
+
+ReplaySystem::ReplaySystem(Pace pace)
+    : pace_(pace) {
+}
+
+ReplaySystem::~ReplaySystem() {
+  Unmap();
+}
+
+bool
+ReplaySystem::Open(const std::string& filename) {
+  Rewind();
+  Unmap();
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Error opening recording " << filename << ": "
+        << std::strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat info;
+  if (::fstat(fd, &info) < 0 ||
+      static_cast<std::size_t>(info.st_size) < sizeof(RecordFileHeader)) {
+    std::cerr << "Invalid recording " << filename << std::endl;
+    ::close(fd);
+    return false;
+  }
+  void* data = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << "Error mapping recording " << filename << ": "
+        << std::strerror(errno) << std::endl;
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = info.st_size;
+
+  RecordFileHeader header;
+  std::memcpy(&header, data_, sizeof(header));
+  if (std::memcmp(header.magic, Recorder::kMagic, sizeof(header.magic)) != 0 ||
+      header.version != Recorder::kVersion) {
+    std::cerr << "Unsupported recording " << filename << std::endl;
+    Unmap();
+    return false;
+  }
+  offset_ = sizeof(header);
+  return true;
+}
+
+bool
+ReplaySystem::Finished() const {
+  return offset_ + sizeof(RecordEntry) > size_;
+}
+
+void
+ReplaySystem::Rewind() {
+  for (ReplayDevice& device : devices_) {
+    ReplayDetach(device.device.device_id);
+  }
+  offset_ = data_ != nullptr ? sizeof(RecordFileHeader) : 0;
+  started_ = false;
+}
+
+void
+ReplaySystem::ProcessEvents() {
+  if (!started_) {
+    Start();
+  }
+  BeginProcessing();
+  if (pace_ == Pace::kAsFastAsPossible) {
+    ReplayUntil(std::numeric_limits<double>::infinity());
+  } else {
+    ReplayUntil(CurrentTime());
+  }
+  EndProcessing();
+}
+
+void
+ReplaySystem::WaitForEvents(int timeout_ms) {
+  if (!started_) {
+    Start();
+  }
+  // Wake up in time for delayed axis changes and settling filters.
+  timeout_ms = WaitTimeout(timeout_ms);
+  RecordEntry entry;
+  if (pace_ == Pace::kRecorded && PeekEntry(&entry)) {
+    // Sleep until the next entry is due, but not longer than the timeout.
+    const std::chrono::duration<double> delay(
+        entry.timestamp - start_timestamp_);
+    SteadyClock::time_point wake_time = start_time_ +
+        std::chrono::duration_cast<SteadyClock::duration>(delay);
+    if (timeout_ms >= 0) {
+      wake_time = std::min(wake_time,
+          SteadyClock::now() + std::chrono::milliseconds(timeout_ms));
+    }
+    std::this_thread::sleep_until(wake_time);
+  }
+  ProcessEvents();
+}
+
+double
+ReplaySystem::CurrentTime() const {
+  if (pace_ == Pace::kAsFastAsPossible) {
+    return last_timestamp_;
+  }
+  const std::chrono::duration<double> elapsed =
+      SteadyClock::now() - start_time_;
+  return start_timestamp_ + elapsed.count();
+}
+
+void
+ReplaySystem::ScanForDevices() {
+}
+
+Device*
+ReplaySystem::GetDevice(DeviceHandle handle) {
+  ReplayDevice* device = devices_.Get(handle);
+  return device != nullptr ? &device->device : nullptr;
+}
+
+void
+ReplaySystem::Start() {
+  // Attach entries at the start of a recording carry no timestamp. The
+  // replay time starts with the first event.
+  started_ = true;
+  start_time_ = SteadyClock::now();
+  start_timestamp_ = 0.0;
+  for (std::size_t offset = offset_; offset + sizeof(RecordEntry) <= size_;) {
+    RecordEntry entry;
+    std::memcpy(&entry, data_ + offset, sizeof(entry));
+    if (entry.kind == kRecordEvent) {
+      start_timestamp_ = entry.timestamp;
+      break;
+    }
+    if (entry.kind == kRecordAttach && entry.value < 0) {
+      break;
+    }
+    offset += sizeof(entry) + (entry.kind == kRecordAttach ? entry.value : 0);
+  }
+}
+
+void
+ReplaySystem::ReplayUntil(double timestamp) {
+  RecordEntry entry;
+  while (PeekEntry(&entry) &&
+      (entry.kind != kRecordEvent || entry.timestamp <= timestamp)) {
+    ReplayEntry();
+  }
+}
+
+bool
+ReplaySystem::PeekEntry(RecordEntry* entry) const {
+  if (Finished()) {
+    return false;
+  }
+  std::memcpy(entry, data_ + offset_, sizeof(*entry));
+  return true;
+}
+
+void
+ReplaySystem::ReplayEntry() {
+  RecordEntry entry;
+  std::memcpy(&entry, data_ + offset_, sizeof(entry));
+  offset_ += sizeof(entry);
+  switch (entry.kind) {
+    case kRecordEvent:
+      ReplayEvent(entry);
+      break;
+    case kRecordAttach:
+      if (entry.value < 0 ||
+          static_cast<std::size_t>(entry.value) > size_ - offset_) {
+        std::cerr << "Truncated recording" << std::endl;
+        offset_ = size_;
+        return;
+      }
+      ReplayAttach(entry, data_ + offset_);
+      offset_ += entry.value;
+      break;
+    case kRecordDetach:
+      ReplayDetach(entry.device_id);
+      break;
+    default:
+      std::cerr << "Invalid recording entry" << std::endl;
+      offset_ = size_;
+      break;
+  }
+}
+
+void
+ReplaySystem::ReplayAttach(const RecordEntry& entry, const char* data) {
+  RecordedDevice recorded;
+  if (entry.device_id > kMaxDeviceId ||
+      !DecodeRecordedDevice(data, entry.value, &recorded)) {
+    std::cerr << "Invalid device in recording" << std::endl;
+    return;
+  }
+  ReplayDetach(entry.device_id);
+
+  const DeviceHandle handle = devices_.Insert();
+  ReplayDevice& device = *devices_.Get(handle);
+  device.device.handle = handle;
+  device.device.device_id = entry.device_id;
+  device.device.vendor_id = recorded.vendor_id;
+  device.device.product_id = recorded.product_id;
+  device.device.description = recorded.description;
+
+  device.button_ids.assign(kRecordKeyCount, -1);
+  for (std::size_t i = 0; i < recorded.button_codes.size(); ++i) {
+    if (recorded.button_codes[i] < kRecordKeyCount) {
+      device.button_ids[recorded.button_codes[i]] = static_cast<int16_t>(i);
+    }
+  }
+  device.device.buttons.resize(recorded.button_codes.size(), false);
+
+  std::fill(device.axis_ids, device.axis_ids + kRecordAbsCount, -1);
+  for (std::size_t i = 0; i < recorded.axes.size(); ++i) {
+    const RecordedAxis& axis = recorded.axes[i];
+    if (axis.code < kRecordAbsCount) {
+      device.axis_ids[axis.code] = static_cast<int8_t>(i);
+    }
+    device.transforms.push_back(MakeAxisTransform(axis.minimum, axis.maximum,
+        axis.fuzz, axis.flat));
+  }
+  device.device.axes.resize(recorded.axes.size(), 0.0f);
+
+  if (handles_.size() <= entry.device_id) {
+    handles_.resize(entry.device_id + 1);
+  }
+  handles_[entry.device_id] = handle;
+  HandleAttach(&device.device);
+}
+
+void
+ReplaySystem::ReplayDetach(unsigned int device_id) {
+  ReplayDevice* device = FindDevice(device_id);
+  if (device == nullptr) {
+    return;
+  }
+  HandleDetach(&device->device);
+  devices_.Erase(device->device.handle);
+  handles_[device_id] = DeviceHandle();
+}
+
+void
+ReplaySystem::ReplayEvent(const RecordEntry& entry) {
+  ReplayDevice* device = FindDevice(entry.device_id);
+  if (device == nullptr) {
+    return;
+  }
+  HandleEventRead(&device->device);
+  last_timestamp_ = entry.timestamp;
+  if (entry.type == kRecordEvSyn) {
+    if (entry.code == kRecordSynReport) {
+      HandleReport(&device->device);
+    } else if (entry.code == kRecordSynDropped) {
+      HandleResync(&device->device);
+    }
+  } else if (entry.type == kRecordEvKey && entry.code < kRecordKeyCount) {
+    const int button_id = device->button_ids[entry.code];
+    if (button_id >= 0) {
+      HandleButtonEvent(&device->device, button_id, entry.value,
+          entry.timestamp);
+    }
+  } else if (entry.type == kRecordEvAbs && entry.code < kRecordAbsCount) {
+    const int axis_id = device->axis_ids[entry.code];
+    if (axis_id >= 0) {
+      HandleAxisEvent(&device->device, axis_id, entry.value,
+          device->transforms[axis_id], entry.timestamp);
+    }
+  }
+}
+
+ReplayDevice*
+ReplaySystem::FindDevice(unsigned int device_id) {
+  if (device_id >= handles_.size()) {
+    return nullptr;
+  }
+  return devices_.Get(handles_[device_id]);
+}
+
+void
+ReplaySystem::Unmap() {
+  if (data_ != nullptr) {
+    ::munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+  }
+  size_ = 0;
+  offset_ = 0;
+}
+
+}  // namespace gamepad
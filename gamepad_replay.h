@@ -0,0 +1,98 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_REPLAY_HEADER
+#define GAMEPAD_REPLAY_HEADER
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gamepad.h"
+#include "gamepad_record.h"
+#include "gamepad_slot_map.h"
+
+namespace gamepad {
+
+struct ReplayDevice {
+  Device device;
+  // Button and axis IDs indexed by event code, or -1 if not mapped.
+  std::vector<int16_t> button_ids;
+  int8_t axis_ids[kRecordAbsCount];
+  std::vector<AxisTransform> transforms;
+};
+
+// A system that replays a recording made with System::StartRecording().
+// The recording is memory-mapped and its events are passed through the same
+// processing as live input. Devices are attached and detached as their
+// entries are replayed, with the recorded device IDs and timestamps.
+class ReplaySystem : public System {
+ public:
+  enum class Pace {
+    // Each ProcessEvents() call replays the rest of the recording.
+    kAsFastAsPossible,
+    // Events are replayed at the time they were recorded, relative to the
+    // first ProcessEvents() or WaitForEvents() call.
+    kRecorded,
+  };
+
+ public:
+  explicit ReplaySystem(Pace pace);
+  ~ReplaySystem() override;
+
+  // Maps the recording file. Returns false on error.
+  bool Open(const std::string& filename);
+  // Returns true if all entries have been replayed.
+  bool Finished() const;
+  // Detaches all devices and restarts the replay.
+  void Rewind();
+
+  // Keep the visitor overloads of System visible.
+  using System::ProcessEvents;
+  using System::WaitForEvents;
+  void ProcessEvents() override;
+  void WaitForEvents(int timeout_ms) override;
+  // Devices are attached by the replay, there is nothing to scan.
+  void ScanForDevices() override;
+  Device* GetDevice(DeviceHandle handle) override;
+
+ protected:
+  // Returns the recorded time of the replay. Replaying as fast as possible
+  // has no real time, the time of the last replayed event is used instead.
+  double CurrentTime() const override;
+
+ private:
+  typedef std::chrono::steady_clock SteadyClock;
+
+  void Start();
+  void ReplayUntil(double timestamp);
+  bool PeekEntry(RecordEntry* entry) const;
+  void ReplayEntry();
+  void ReplayAttach(const RecordEntry& entry, const char* data);
+  void ReplayDetach(unsigned int device_id);
+  void ReplayEvent(const RecordEntry& entry);
+  ReplayDevice* FindDevice(unsigned int device_id);
+  void Unmap();
+
+ private:
+  Pace pace_;
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t offset_ = 0;
+  // The recorded time that corresponds to the replay start time.
+  bool started_ = false;
+  double start_timestamp_ = 0.0;
+  SteadyClock::time_point start_time_;
+  double last_timestamp_ = 0.0;
+
+  SlotMap<ReplayDevice> devices_;
+  // Handles of the attached devices, indexed by recorded device ID.
+  std::vector<DeviceHandle> handles_;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_REPLAY_HEADER
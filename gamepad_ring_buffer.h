@@ -0,0 +1,107 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_RING_BUFFER_HEADER
+#define GAMEPAD_RING_BUFFER_HEADER
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace gamepad {
+
+// A fixed-capacity, lock-free queue for exactly one producer thread and one
+// consumer thread. The capacity is rounded up to a power of two. Push() and
+// Pop() never block and never allocate.
+template <typename T>
+class SpscRingBuffer {
+ public:
+  explicit SpscRingBuffer(std::size_t capacity);
+
+  // Producer: Appends an item. Returns false if the queue is full.
+  bool Push(const T& item);
+  // Producer: Returns the number of items that can be pushed.
+  std::size_t Available() const;
+
+  // Consumer: Removes the oldest item. Returns false if the queue is empty.
+  bool Pop(T* item);
+  // Consumer: Returns the number of items that can be popped.
+  std::size_t Size() const;
+
+  std::size_t Capacity() const { return buffer_.size(); }
+
+ private:
+  // Keep the positions on separate cache lines to avoid false sharing
+  // between the producer and the consumer.
+  static constexpr std::size_t kCacheLine = 64;
+
+  std::vector<T> buffer_;
+  std::size_t mask_ = 0;
+  char pad0_[kCacheLine];
+  // Written by the consumer.
+  std::atomic<std::size_t> head_;
+  char pad1_[kCacheLine];
+  // Written by the producer.
+  std::atomic<std::size_t> tail_;
+  char pad2_[kCacheLine];
+};
+
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+SpscRingBuffer<T>::SpscRingBuffer(std::size_t capacity)
+    : head_(0), tail_(0) {
+  std::size_t size = 1;
+  while (size < capacity) {
+    size *= 2;
+  }
+  buffer_.resize(size);
+  mask_ = size - 1;
+}
+
+template <typename T>
+bool
+SpscRingBuffer<T>::Push(const T& item) {
+  const std::size_t tail = tail_.load(std::memory_order_relaxed);
+  const std::size_t head = head_.load(std::memory_order_acquire);
+  if (tail - head == buffer_.size()) {
+    return false;
+  }
+  buffer_[tail & mask_] = item;
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+std::size_t
+SpscRingBuffer<T>::Available() const {
+  const std::size_t tail = tail_.load(std::memory_order_relaxed);
+  const std::size_t head = head_.load(std::memory_order_acquire);
+  return buffer_.size() - (tail - head);
+}
+
+template <typename T>
+bool
+SpscRingBuffer<T>::Pop(T* item) {
+  const std::size_t head = head_.load(std::memory_order_relaxed);
+  const std::size_t tail = tail_.load(std::memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+  *item = buffer_[head & mask_];
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+std::size_t
+SpscRingBuffer<T>::Size() const {
+  const std::size_t head = head_.load(std::memory_order_relaxed);
+  const std::size_t tail = tail_.load(std::memory_order_acquire);
+  return tail - head;
+}
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_RING_BUFFER_HEADER
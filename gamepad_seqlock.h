@@ -0,0 +1,120 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_SEQLOCK_HEADER
+#define GAMEPAD_SEQLOCK_HEADER
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace gamepad {
+
+// A sequence lock that protects a trivially copyable value for a single
+// writer and any number of readers. The writer never waits, readers retry
+// while a write is in progress. The value is stored in atomic words, which
+// makes concurrent access well-defined, also between processes if the lock
+// is placed in shared memory.
+template <typename T>
+class Seqlock {
+ public:
+  Seqlock();
+
+  // Writer: Stores a new value.
+  void Store(const T& value);
+  // Reader: Makes a single attempt to load a consistent value. Returns false
+  // if a write was in progress.
+  bool TryLoad(T* value) const;
+  // Reader: Loads a consistent value, retrying while writes are in progress.
+  void Load(T* value) const;
+  // Reader: Loads like Load(), but gives up after max_attempts attempts.
+  // Returns false if no attempt succeeded. Readers that must not depend on
+  // the writer, e.g., in another process that may die during a write and
+  // leave the lock odd forever, use this instead of Load().
+  bool Load(T* value, int max_attempts) const;
+  // Returns the number of completed writes.
+  uint64_t Version() const;
+
+ private:
+  static_assert(std::is_trivially_copyable<T>::value,
+      "Seqlock requires a trivially copyable type");
+  static constexpr std::size_t kNumWords = (sizeof(T) + 7) / 8;
+
+  // Odd while a write is in progress.
+  std::atomic<uint64_t> sequence_;
+  std::atomic<uint64_t> words_[kNumWords];
+};
+
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+Seqlock<T>::Seqlock()
+    : sequence_(0) {
+  for (std::size_t i = 0; i < kNumWords; ++i) {
+    words_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+void
+Seqlock<T>::Store(const T& value) {
+  uint64_t buffer[kNumWords] = {};
+  std::memcpy(buffer, &value, sizeof(T));
+
+  const uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (std::size_t i = 0; i < kNumWords; ++i) {
+    words_[i].store(buffer[i], std::memory_order_relaxed);
+  }
+  sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+template <typename T>
+bool
+Seqlock<T>::TryLoad(T* value) const {
+  const uint64_t before = sequence_.load(std::memory_order_acquire);
+  if (before & 1) {
+    return false;
+  }
+  uint64_t buffer[kNumWords];
+  for (std::size_t i = 0; i < kNumWords; ++i) {
+    buffer[i] = words_[i].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t after = sequence_.load(std::memory_order_relaxed);
+  if (before != after) {
+    return false;
+  }
+  std::memcpy(value, buffer, sizeof(T));
+  return true;
+}
+
+template <typename T>
+void
+Seqlock<T>::Load(T* value) const {
+  while (!TryLoad(value)) {}
+}
+
+template <typename T>
+bool
+Seqlock<T>::Load(T* value, int max_attempts) const {
+  for (int i = 0; i < max_attempts; ++i) {
+    if (TryLoad(value)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+uint64_t
+Seqlock<T>::Version() const {
+  return sequence_.load(std::memory_order_acquire) / 2;
+}
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_SEQLOCK_HEADER
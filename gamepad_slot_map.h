@@ -0,0 +1,133 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_SLOT_MAP_HEADER
+#define GAMEPAD_SLOT_MAP_HEADER
+
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <vector>
+
+#include "gamepad.h"
+
+namespace gamepad {
+
+// A container with stable element addresses and O(1) lookup by handle.
+// Erased slots are re-used by later insertions. Each slot carries a
+// generation that is incremented on erase, so handles to erased elements
+// are detected as stale. Element memory is never released before the
+// container is destroyed, so cached pointers never dangle; use the handle
+// to check whether the element is still the same.
+template <typename T>
+class SlotMap {
+ private:
+  struct Slot {
+    uint32_t generation = 1;
+    bool occupied = false;
+    T value;
+  };
+
+ public:
+  // Iterates over occupied slots.
+  class iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T* pointer;
+    typedef T& reference;
+
+    iterator(std::deque<Slot>* slots, std::size_t index)
+        : slots_(slots), index_(index) { SkipFree(); }
+    T& operator*() const { return (*slots_)[index_].value; }
+    T* operator->() const { return &(*slots_)[index_].value; }
+    iterator& operator++() { ++index_; SkipFree(); return *this; }
+    iterator operator++(int) { iterator tmp = *this; ++*this; return tmp; }
+    bool operator==(const iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const iterator& other) const {
+      return index_ != other.index_;
+    }
+
+   private:
+    void SkipFree() {
+      while (index_ < slots_->size() && !(*slots_)[index_].occupied) {
+        ++index_;
+      }
+    }
+
+    std::deque<Slot>* slots_;
+    std::size_t index_;
+  };
+
+ public:
+  // Inserts a default-constructed element and returns its handle.
+  DeviceHandle Insert();
+  // Marks the element as erased. The element is reset on re-use.
+  void Erase(DeviceHandle handle);
+  // Returns the element for the handle, or nullptr if the handle is stale.
+  T* Get(DeviceHandle handle);
+  // Returns the number of occupied slots.
+  std::size_t size() const { return slots_.size() - free_.size(); }
+
+  iterator begin() { return iterator(&slots_, 0); }
+  iterator end() { return iterator(&slots_, slots_.size()); }
+
+ private:
+  std::deque<Slot> slots_;
+  std::vector<uint32_t> free_;
+};
+
+/* ---------------------------------------------------------------- */
+
+template <typename T>
+DeviceHandle
+SlotMap<T>::Insert() {
+  DeviceHandle handle;
+  if (free_.empty()) {
+    // Deque insertion at the end keeps the addresses of all elements.
+    handle.index = static_cast<uint32_t>(slots_.size());
+    slots_.emplace_back();
+  } else {
+    handle.index = free_.back();
+    free_.pop_back();
+    slots_[handle.index].value = T();
+  }
+  Slot& slot = slots_[handle.index];
+  slot.occupied = true;
+  handle.generation = slot.generation;
+  return handle;
+}
+
+template <typename T>
+void
+SlotMap<T>::Erase(DeviceHandle handle) {
+  if (Get(handle) == nullptr) {
+    return;
+  }
+  Slot& slot = slots_[handle.index];
+  slot.occupied = false;
+  // Skip generation zero, which is reserved for invalid handles.
+  slot.generation = slot.generation + 1 == 0 ? 1 : slot.generation + 1;
+  free_.push_back(handle.index);
+}
+
+template <typename T>
+T*
+SlotMap<T>::Get(DeviceHandle handle) {
+  if (handle.index >= slots_.size()) {
+    return nullptr;
+  }
+  Slot& slot = slots_[handle.index];
+  if (!slot.occupied || slot.generation != handle.generation) {
+    return nullptr;
+  }
+  return &slot.value;
+}
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_SLOT_MAP_HEADER
@@ -0,0 +1,236 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+namespace gamepad {
+namespace {
+
+// Identifies an initialized segment, and changes with the segment layout.
+constexpr uint64_t kSegmentMagic = 0x3130534450474d47ull;  // "GMPGDS01"
+
+}  // namespace
+
+constexpr int Snapshot::kMaxAxes;
+constexpr int Snapshot::kMaxButtons;
+constexpr int SnapshotTable::kNumSlots;
+constexpr int SnapshotTable::kMaxLoadAttempts;
+
+// The layout of the shared memory segment. The creator writes the magic
+// last, so readers never see a partially initialized table.
+struct SharedSnapshotTable::Segment {
+  std::atomic<uint64_t> magic;
+  uint64_t size;
+  std::atomic<uint32_t> published;
+  SnapshotTable table;
+};
+
+SnapshotTable::SnapshotTable() {
+  for (int i = 0; i < kNumSlots; ++i) {
+    owners_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+int
+SnapshotTable::FindFreeSlot() const {
+  for (int i = 0; i < kNumSlots; ++i) {
+    if (owners_[i].load(std::memory_order_relaxed) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void
+SnapshotTable::Store(int slot, const Snapshot& snapshot) {
+  snapshots_[slot].Store(snapshot);
+}
+
+void
+SnapshotTable::SetOwner(int slot, unsigned int device_id) {
+  owners_[slot].store(static_cast<uint64_t>(device_id) + 1,
+      std::memory_order_release);
+}
+
+void
+SnapshotTable::ClearOwner(int slot) {
+  owners_[slot].store(0, std::memory_order_release);
+}
+
+void
+SnapshotTable::CopyFrom(const SnapshotTable& other) {
+  Snapshot snapshot;
+  for (int i = 0; i < kNumSlots; ++i) {
+    other.snapshots_[i].Load(&snapshot);
+    snapshots_[i].Store(snapshot);
+    owners_[i].store(other.owners_[i].load(std::memory_order_acquire),
+        std::memory_order_release);
+  }
+}
+
+bool
+SnapshotTable::Load(unsigned int device_id, Snapshot* snapshot) const {
+  const uint64_t owner = static_cast<uint64_t>(device_id) + 1;
+  for (int i = 0; i < kNumSlots; ++i) {
+    if (owners_[i].load(std::memory_order_acquire) != owner) {
+      continue;
+    }
+    // Do not trust the writer to finish, it may be another process. The
+    // slot may have been re-assigned after the owner check.
+    return snapshots_[i].Load(snapshot, kMaxLoadAttempts) &&
+        snapshot->device_id == device_id && snapshot->sequence > 0;
+  }
+  return false;
+}
+
+int
+SnapshotTable::LoadAll(Snapshot* snapshots, int max_snapshots) const {
+  int num_loaded = 0;
+  for (int i = 0; i < kNumSlots && num_loaded < max_snapshots; ++i) {
+    const uint64_t owner = owners_[i].load(std::memory_order_acquire);
+    if (owner == 0) {
+      continue;
+    }
+    Snapshot* snapshot = &snapshots[num_loaded];
+    if (snapshots_[i].Load(snapshot, kMaxLoadAttempts) &&
+        static_cast<uint64_t>(snapshot->device_id) + 1 == owner &&
+        snapshot->sequence > 0) {
+      num_loaded += 1;
+    }
+  }
+  return num_loaded;
+}
+
+/* ---------------------------------------------------------------- */
+
+SharedSnapshotTable::~SharedSnapshotTable() {
+  Close();
+}
+
+bool
+SharedSnapshotTable::Create(const std::string& name) {
+  static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+      "Shared memory requires lock-free atomics");
+  Close();
+  // Readers of a replaced segment keep their mapping of the old segment.
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    std::cerr << "Error creating shared memory " << name << ": "
+        << std::strerror(errno) << std::endl;
+    return false;
+  }
+  void* memory = MAP_FAILED;
+  if (ftruncate(fd, sizeof(Segment)) == 0) {
+    memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+  }
+  const int error = errno;
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cerr << "Error mapping shared memory " << name << ": "
+        << std::strerror(error) << std::endl;
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  Segment* segment = static_cast<Segment*>(memory);
+  segment->size = sizeof(Segment);
+  segment->published.store(1, std::memory_order_relaxed);
+  new (&segment->table) SnapshotTable();
+  segment->magic.store(kSegmentMagic, std::memory_order_release);
+  segment_ = segment;
+  name_ = name;
+  creator_ = true;
+  return true;
+}
+
+bool
+SharedSnapshotTable::Open(const std::string& name) {
+  Close();
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  // The creator may not have sized the segment yet.
+  struct stat info;
+  void* memory = MAP_FAILED;
+  if (fstat(fd, &info) == 0 &&
+      static_cast<std::size_t>(info.st_size) >= sizeof(Segment)) {
+    memory = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  Segment* segment = static_cast<Segment*>(memory);
+  if (segment->magic.load(std::memory_order_acquire) != kSegmentMagic ||
+      segment->size != sizeof(Segment)) {
+    munmap(memory, sizeof(Segment));
+    return false;
+  }
+  segment_ = segment;
+  name_ = name;
+  creator_ = false;
+  return true;
+}
+
+void
+SharedSnapshotTable::Close() {
+  if (segment_ == nullptr) {
+    return;
+  }
+  if (creator_) {
+    for (int i = 0; i < SnapshotTable::kNumSlots; ++i) {
+      segment_->table.ClearOwner(i);
+    }
+    segment_->published.store(0, std::memory_order_release);
+    shm_unlink(name_.c_str());
+  }
+  munmap(segment_, sizeof(Segment));
+  segment_ = nullptr;
+  name_.clear();
+  creator_ = false;
+}
+
+bool
+SharedSnapshotTable::IsPublished() const {
+  return segment_ != nullptr &&
+      segment_->published.load(std::memory_order_acquire) != 0;
+}
+
+SnapshotTable*
+SharedSnapshotTable::Table() {
+  return &segment_->table;
+}
+
+const SnapshotTable*
+SharedSnapshotTable::Table() const {
+  return &segment_->table;
+}
+
+/* ---------------------------------------------------------------- */
+
+bool
+StateReader::GetSnapshot(unsigned int device_id, Snapshot* snapshot) const {
+  return segment_.IsOpen() && segment_.Table()->Load(device_id, snapshot);
+}
+
+int
+StateReader::GetSnapshots(Snapshot* snapshots, int max_snapshots) const {
+  return segment_.IsOpen()
+      ? segment_.Table()->LoadAll(snapshots, max_snapshots) : 0;
+}
+
+}  // namespace gamepad
@@ -0,0 +1,144 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_SNAPSHOT_HEADER
+#define GAMEPAD_SNAPSHOT_HEADER
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "gamepad_seqlock.h"
+
+namespace gamepad {
+
+// A copy of the state of a device, see System::GetSnapshot().
+struct Snapshot {
+  static constexpr int kMaxAxes = 32;
+  static constexpr int kMaxButtons = 128;
+
+  unsigned int device_id = 0;
+  // Incremented every time a new state is published.
+  uint64_t sequence = 0;
+  // Timestamp of the last report in seconds, see System::SetClock().
+  double timestamp = 0.0;
+  // Number of axes and buttons, limited to kMaxAxes and kMaxButtons.
+  int num_axes = 0;
+  int num_buttons = 0;
+  float axes[kMaxAxes] = {};
+  uint64_t buttons[kMaxButtons / 64] = {};
+
+  bool Button(int button_id) const {
+    return (buttons[button_id / 64] >> (button_id % 64)) & 1;
+  }
+};
+
+// The published snapshots of up to kNumSlots devices, with a seqlock per
+// device. A slot is owned by a device while its owner word holds the device
+// ID plus one. The table only contains atomic words, so it can be placed in
+// shared memory and read by other processes.
+class SnapshotTable {
+ public:
+  static constexpr int kNumSlots = 16;
+  // Attempts of a reader to load a consistent state of a slot. A write
+  // takes a few dozen nanoseconds, so only a writer that was preempted or
+  // died during a write exhausts the attempts.
+  static constexpr int kMaxLoadAttempts = 1000;
+
+ public:
+  SnapshotTable();
+
+  // Writer: Returns a slot without owner, or -1 if all slots are in use.
+  int FindFreeSlot() const;
+  // Writer: Publishes the state of the slot. The device ID of the state
+  // must match the owner for readers to accept it.
+  void Store(int slot, const Snapshot& snapshot);
+  // Writer: Assigns the slot to the device, or releases it.
+  void SetOwner(int slot, unsigned int device_id);
+  void ClearOwner(int slot);
+  // Writer: Copies all slots and owners of the other table.
+  void CopyFrom(const SnapshotTable& other);
+
+  // Reader: Copies the state of the device. Returns false if the device
+  // does not own a slot, or if no consistent state could be read within
+  // kMaxLoadAttempts, e.g., because the writer died during a write.
+  bool Load(unsigned int device_id, Snapshot* snapshot) const;
+  // Reader: Copies the states of all devices that own a slot, up to
+  // max_snapshots. Slots without a consistent state within
+  // kMaxLoadAttempts are skipped. Returns the number of states copied.
+  int LoadAll(Snapshot* snapshots, int max_snapshots) const;
+
+ private:
+  std::atomic<uint64_t> owners_[kNumSlots];
+  Seqlock<Snapshot> snapshots_[kNumSlots];
+};
+
+// A snapshot table in a POSIX shared memory segment. One process creates
+// the segment and publishes states, see System::StartPublishing(). Other
+// processes open it read-only with a StateReader.
+class SharedSnapshotTable {
+ public:
+  SharedSnapshotTable() = default;
+  SharedSnapshotTable(const SharedSnapshotTable&) = delete;
+  SharedSnapshotTable& operator=(const SharedSnapshotTable&) = delete;
+  ~SharedSnapshotTable();
+
+  // Creates the segment with the name, which starts with a slash, e.g.,
+  // "/gamepad". An existing segment of the name, e.g., of a crashed
+  // publisher, is replaced. Readers keep the replaced segment until they
+  // open the name again.
+  bool Create(const std::string& name);
+  // Maps an existing segment read-only. Fails if the segment has not been
+  // initialized yet or has an incompatible layout.
+  bool Open(const std::string& name);
+  // Unmaps the segment. The creator also removes the name and marks the
+  // segment as no longer published.
+  void Close();
+
+  bool IsOpen() const { return segment_ != nullptr; }
+  // Returns true if the creator of the segment has not closed it.
+  bool IsPublished() const;
+  // The table of the segment. Must be open.
+  SnapshotTable* Table();
+  const SnapshotTable* Table() const;
+
+ private:
+  struct Segment;
+
+  Segment* segment_ = nullptr;
+  std::string name_;
+  bool creator_ = false;
+};
+
+// Reads the device states that another process publishes, see
+// System::StartPublishing(). Reading copies from shared memory without
+// syscalls and without blocking the publisher.
+class StateReader {
+ public:
+  // Maps the segment of the publisher. Returns false if the segment does
+  // not exist or is not ready. Open again if the publisher restarts.
+  bool Open(const std::string& name) { return segment_.Open(name); }
+  void Close() { segment_.Close(); }
+  bool IsOpen() const { return segment_.IsOpen(); }
+  // Returns false once the publisher has stopped publishing.
+  bool IsPublished() const { return segment_.IsPublished(); }
+
+  // Copies the state of the device. Returns false if the device is not
+  // attached to the publisher or the reader is not open. Reading never
+  // waits for the publisher: If the publisher is in the middle of a write
+  // for too long, or died during one, this returns false as well.
+  bool GetSnapshot(unsigned int device_id, Snapshot* snapshot) const;
+  // Copies the states of all published devices, up to max_snapshots, and
+  // skips states that cannot be read like GetSnapshot().
+  // Returns the number of states copied.
+  int GetSnapshots(Snapshot* snapshots, int max_snapshots) const;
+
+ private:
+  SharedSnapshotTable segment_;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_SNAPSHOT_HEADER
@@ -0,0 +1,186 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#include "gamepad_synthetic.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <thread>
+
+namespace gamepad {
+namespace {
+// Raw axis range of the synthetic devices, like typical 16-bit sticks.
+constexpr int kAxisMinimum = -32768;
+constexpr int kAxisMaximum = 32767;
+constexpr int kAxisFuzz = 16;
+constexpr int kAxisFlat = 128;
+}  // namespace
+
+SyntheticSystem::SyntheticSystem(const SyntheticConfig& config)
+    : config_(config) {
+  transform_ = MakeAxisTransform(kAxisMinimum, kAxisMaximum, kAxisFuzz,
+      kAxisFlat);
+  report_interval_ = config_.report_rate > 0.0
+      ? 1.0 / config_.report_rate
+      : std::numeric_limits<double>::infinity();
+  random_state_ = config_.seed != 0 ? config_.seed : 1;
+}
+
+void
+SyntheticSystem::Advance(double seconds) {
+  // The reports of the interval are processed at the end of the interval,
+  // like pending input of real devices is processed when it is polled.
+  time_ += seconds;
+  BeginProcessing();
+
+  // Generate the reports of each device in the interval. Like the read loop
+  // of real devices, all pending reports of a device are processed at once.
+  for (std::size_t i = 0; i < attached_.size(); ++i) {
+    SyntheticDevice* device = devices_.Get(attached_[i]);
+    while (device->next_report <= time_) {
+      GenerateReport(device);
+    }
+  }
+
+  // Replace random devices according to the churn rate.
+  churn_ += config_.churn_rate * seconds;
+  while (churn_ >= 1.0 && !attached_.empty()) {
+    churn_ -= 1.0;
+    Detach(devices_.Get(attached_[Random() % attached_.size()]));
+    Attach();
+  }
+  EndProcessing();
+}
+
+void
+SyntheticSystem::ProcessEvents() {
+  const SteadyClock::time_point now = SteadyClock::now();
+  if (!started_) {
+    started_ = true;
+    last_time_ = now;
+  }
+  const std::chrono::duration<double> elapsed = now - last_time_;
+  last_time_ = now;
+  Advance(elapsed.count());
+}
+
+void
+SyntheticSystem::WaitForEvents(int timeout_ms) {
+  if (!started_) {
+    started_ = true;
+    last_time_ = SteadyClock::now();
+  }
+  // Wake up in time for delayed axis changes and settling filters.
+  timeout_ms = WaitTimeout(timeout_ms);
+  // Sleep until the next report is due, but not longer than the timeout.
+  double delay = NextReportTime() - time_;
+  if (timeout_ms >= 0) {
+    delay = std::min(delay, timeout_ms * 1e-3);
+  }
+  if (delay > 0.0 && delay < std::numeric_limits<double>::infinity()) {
+    std::this_thread::sleep_until(last_time_ +
+        std::chrono::duration_cast<SteadyClock::duration>(
+            std::chrono::duration<double>(delay)));
+  }
+  ProcessEvents();
+}
+
+void
+SyntheticSystem::ScanForDevices() {
+  if (scanned_) {
+    return;
+  }
+  scanned_ = true;
+  for (int i = 0; i < config_.num_devices; ++i) {
+    Attach();
+  }
+}
+
+Device*
+SyntheticSystem::GetDevice(DeviceHandle handle) {
+  SyntheticDevice* device = devices_.Get(handle);
+  return device != nullptr ? &device->device : nullptr;
+}
+
+void
+SyntheticSystem::Attach() {
+  const DeviceHandle handle = devices_.Insert();
+  SyntheticDevice& device = *devices_.Get(handle);
+  device.device.handle = handle;
+  device.device.device_id = next_device_id_++;
+  device.device.description = "Synthetic device " +
+      std::to_string(device.device.device_id);
+  device.device.buttons.resize(std::max(config_.num_buttons, 0), false);
+  device.device.axes.resize(std::max(config_.num_axes, 0), 0.0f);
+
+  // Spread the reports of the devices over the report interval.
+  const double phase = static_cast<double>(Random()) /
+      std::numeric_limits<uint32_t>::max();
+  device.next_report = time_ + phase * report_interval_;
+  device.attached_index = attached_.size();
+  attached_.push_back(handle);
+  HandleAttach(&device.device);
+}
+
+void
+SyntheticSystem::Detach(SyntheticDevice* device) {
+  HandleDetach(&device->device);
+  // Remove the device from the attached list by swapping with the last.
+  const std::size_t index = device->attached_index;
+  attached_[index] = attached_.back();
+  devices_.Get(attached_[index])->attached_index = index;
+  attached_.pop_back();
+  devices_.Erase(device->device.handle);
+}
+
+void
+SyntheticSystem::GenerateReport(SyntheticDevice* device) {
+  Device* pad = &device->device;
+  const double timestamp = device->next_report;
+  if (!pad->buttons.empty()) {
+    for (int i = 0; i < config_.buttons_per_report; ++i) {
+      HandleEventRead(pad);
+      const int button_id = Random() % pad->buttons.size();
+      HandleButtonEvent(pad, button_id, pad->buttons[button_id] ? 0 : 1,
+          timestamp);
+    }
+    num_events_ += std::max(config_.buttons_per_report, 0);
+  }
+  if (!pad->axes.empty()) {
+    for (int i = 0; i < config_.axes_per_report; ++i) {
+      HandleEventRead(pad);
+      const int axis_id = Random() % pad->axes.size();
+      const int value = kAxisMinimum + static_cast<int>(Random() %
+          (static_cast<uint32_t>(kAxisMaximum - kAxisMinimum) + 1));
+      HandleAxisEvent(pad, axis_id, value, transform_, timestamp);
+    }
+    num_events_ += std::max(config_.axes_per_report, 0);
+  }
+  HandleEventRead(pad);
+  HandleReport(pad);
+  device->next_report += report_interval_;
+}
+
+double
+SyntheticSystem::NextReportTime() {
+  double next_report = std::numeric_limits<double>::infinity();
+  for (const DeviceHandle& handle : attached_) {
+    next_report = std::min(next_report, devices_.Get(handle)->next_report);
+  }
+  return next_report;
+}
+
+uint32_t
+SyntheticSystem::Random() {
+  // Xorshift generator, fast and deterministic across platforms.
+  uint32_t x = random_state_;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  random_state_ = x;
+  return x;
+}
+
+}  // namespace gamepad
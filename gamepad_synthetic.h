@@ -0,0 +1,100 @@
+/*
+ * Written by Simon Fuhrmann.
+ * See LICENSE file for details.
+ */
+#ifndef GAMEPAD_SYNTHETIC_HEADER
+#define GAMEPAD_SYNTHETIC_HEADER
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "gamepad.h"
+#include "gamepad_slot_map.h"
+
+namespace gamepad {
+
+// Configuration of the synthetic devices.
+struct SyntheticConfig {
+  // Number of simultaneously attached devices.
+  int num_devices = 1000;
+  int num_buttons = 16;
+  int num_axes = 6;
+  // Reports per second of each device.
+  double report_rate = 250.0;
+  // Button toggles and axis changes per report.
+  int buttons_per_report = 1;
+  int axes_per_report = 2;
+  // Devices detached and replaced by a new device per second, in total.
+  double churn_rate = 0.0;
+  // Seed of the pseudo-random generator, equal seeds generate equal input.
+  uint32_t seed = 1;
+};
+
+struct SyntheticDevice {
+  Device device;
+  // Simulated time of the next report.
+  double next_report = 0.0;
+  // Index in the list of attached devices.
+  std::size_t attached_index = 0;
+};
+
+// A system that generates input of many simulated devices in-process, to
+// load-test event processing, device bookkeeping and handlers without real
+// devices. Input is generated in simulated time, which starts at zero and
+// is used for the event timestamps.
+class SyntheticSystem : public System {
+ public:
+  explicit SyntheticSystem(const SyntheticConfig& config);
+
+  // Advances the simulated time and processes the input of the interval.
+  // Generates the same input for the same sequence of intervals.
+  void Advance(double seconds);
+  // Returns the number of button and axis events generated so far.
+  uint64_t NumEvents() const { return num_events_; }
+
+  // Keep the visitor overloads of System visible.
+  using System::ProcessEvents;
+  using System::WaitForEvents;
+  // Advances the simulated time by the real time since the last call.
+  void ProcessEvents() override;
+  // Sleeps until the next report is due, then processes events.
+  void WaitForEvents(int timeout_ms) override;
+  // Attaches the configured devices on the first call.
+  void ScanForDevices() override;
+  Device* GetDevice(DeviceHandle handle) override;
+
+ protected:
+  // Returns the simulated time.
+  double CurrentTime() const override { return time_; }
+
+ private:
+  typedef std::chrono::steady_clock SteadyClock;
+
+  void Attach();
+  void Detach(SyntheticDevice* device);
+  void GenerateReport(SyntheticDevice* device);
+  // Returns the simulated time of the next report of any device.
+  double NextReportTime();
+  uint32_t Random();
+
+ private:
+  SyntheticConfig config_;
+  AxisTransform transform_;
+  double report_interval_ = 0.0;
+  double time_ = 0.0;
+  double churn_ = 0.0;
+  uint32_t random_state_ = 1;
+  uint64_t num_events_ = 0;
+  unsigned int next_device_id_ = 0;
+  bool scanned_ = false;
+  bool started_ = false;
+  SteadyClock::time_point last_time_;
+
+  SlotMap<SyntheticDevice> devices_;
+  std::vector<DeviceHandle> attached_;
+};
+
+}  // namespace gamepad
+
+#endif  // GAMEPAD_SYNTHETIC_HEADER
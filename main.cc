@@ -3,8 +3,6 @@
  * See LICENSE file for details.
  */
 #include <iostream>
-#include <chrono>
-#include <thread>
 #include <iomanip>
 
 #include "gamepad.h"
@@ -52,11 +50,14 @@ int main(int argc, char** argv) {
   gamepad->RegisterButtonUpHandler(button_event);
   gamepad->RegisterButtonDownHandler(button_event);
   gamepad->RegisterAxisMoveHandler(axis_event);
+  gamepad->RegisterLogHandler(
+      [](gamepad::System::LogLevel, const std::string& message) {
+        std::cout << message << std::endl;
+      }, gamepad::System::LogLevel::kDebug);
 
   while (true) {
     gamepad->ScanForDevices();
-    gamepad->ProcessEvents();
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    gamepad->WaitForEvents(50);
   }
 
   return 0;